@@ -0,0 +1,119 @@
+"""
+On-disk cache of dump_ast output, used by generate_test.py.
+
+ASTs are stored in build/ast-cache.db (a SQLite database) keyed by the
+SHA-256 of the SQL text together with the SQLite source id and serializer
+version reported by `dump_ast --version` and a hash of the dump_ast binary
+itself. When any of those changes the whole cache is discarded, so every
+rebuild starts afresh and a cached AST is always the one dump_ast would
+produce, whether or not SQLITE_AST_SERIALIZER_VERSION was bumped.
+
+The conformance tests do not use it: they always run the parser.
+"""
+
+import hashlib
+import json
+import sqlite3
+import subprocess
+from pathlib import Path
+
+BUILD_DIR = Path(__file__).parent / "build"
+DUMP_AST = BUILD_DIR / "dump_ast"
+CACHE_PATH = BUILD_DIR / "ast-cache.db"
+
+
+def run_batch(sqls, dump_ast=DUMP_AST):
+    """Parse every SQL string with a single dump_ast --batch process.
+
+    Returns one record per input, in order: {"ast": ...} or {"error": "..."}.
+    """
+    requests = "".join(
+        json.dumps({"id": i, "sql": sql}) + "\n" for i, sql in enumerate(sqls)
+    )
+    result = subprocess.run(
+        [str(dump_ast), "--batch"],
+        input=requests,
+        capture_output=True,
+        text=True,
+        encoding="utf-8",
+    )
+    if result.returncode != 0:
+        raise RuntimeError(f"dump_ast --batch failed: {result.stderr.strip()}")
+    records = [{"error": "dump_ast --batch returned no record"} for _ in sqls]
+    for line in result.stdout.splitlines():
+        record = json.loads(line)
+        records[record.pop("id")] = record
+    return records
+
+
+class AstCache:
+    def __init__(self, path=CACHE_PATH, dump_ast=DUMP_AST):
+        self.dump_ast = dump_ast
+        result = subprocess.run(
+            [str(dump_ast), "--version"],
+            capture_output=True,
+            text=True,
+            timeout=10,
+        )
+        if result.returncode != 0:
+            raise RuntimeError(f"dump_ast --version failed: {result.stderr.strip()}")
+        version = json.loads(result.stdout)
+        binary = hashlib.sha256(Path(dump_ast).read_bytes()).hexdigest()
+        self.version = (
+            f"{version['sqlite_source_id']}\n{version['serializer_version']}\n{binary}"
+        )
+
+        Path(path).parent.mkdir(parents=True, exist_ok=True)
+        self.db = sqlite3.connect(path, timeout=60)
+        with self.db:
+            self.db.execute("CREATE TABLE IF NOT EXISTS meta(version TEXT NOT NULL)")
+            self.db.execute(
+                "CREATE TABLE IF NOT EXISTS asts("
+                "key BLOB PRIMARY KEY, ast TEXT NOT NULL) WITHOUT ROWID"
+            )
+            row = self.db.execute("SELECT version FROM meta").fetchone()
+            if row is None or row[0] != self.version:
+                self.db.execute("DELETE FROM asts")
+                self.db.execute("DELETE FROM meta")
+                self.db.execute("INSERT INTO meta VALUES (?)", (self.version,))
+
+    def key(self, sql):
+        return hashlib.sha256(f"{self.version}\0{sql}".encode()).digest()
+
+    def parse_many(self, sqls):
+        """Like run_batch(), but only runs dump_ast for SQL not yet cached.
+
+        Successful parses are added to the cache; errors are not cached.
+        """
+        keys = [self.key(sql) for sql in sqls]
+        cached = {}
+        for i in range(0, len(keys), 500):
+            chunk = keys[i : i + 500]
+            placeholders = ",".join("?" * len(chunk))
+            cached.update(
+                self.db.execute(
+                    f"SELECT key, ast FROM asts WHERE key IN ({placeholders})", chunk
+                )
+            )
+
+        misses = [i for i, key in enumerate(keys) if key not in cached]
+        records = [None] * len(sqls)
+        if misses:
+            for i, record in zip(misses, run_batch([sqls[i] for i in misses], self.dump_ast)):
+                records[i] = record
+            with self.db:
+                self.db.executemany(
+                    "INSERT OR REPLACE INTO asts VALUES (?, ?)",
+                    [
+                        (keys[i], json.dumps(records[i]["ast"]))
+                        for i in misses
+                        if "ast" in records[i]
+                    ],
+                )
+        for i, key in enumerate(keys):
+            if records[i] is None:
+                records[i] = {"ast": json.loads(cached[key])}
+        return records
+
+    def close(self):
+        self.db.close()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Measure dump_ast throughput over the fixture corpus.
+
+Usage: python bench/bench_fixtures.py [--rounds N] [COMMAND ...]
+
+Each COMMAND (default: build/dump_ast) is run once in --batch mode with
+every fixture's SQL repeated N times on stdin, and the wall-clock rate is
+reported. Pass several commands to compare builds, for example a binary
+built from the previous commit against the current one:
+
+  python bench/bench_fixtures.py /tmp/dump_ast.before build/dump_ast
+"""
+
+import argparse
+import json
+import shlex
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent.parent
+AST_TESTS_DIR = ROOT / "sqlite_ast_conformance" / "ast-tests"
+
+
+def load_requests(rounds: int) -> bytes:
+    lines = []
+    for path in sorted(AST_TESTS_DIR.glob("*.json")):
+        with open(path) as f:
+            sql = json.load(f)["sql"]
+        lines.append(json.dumps({"id": path.stem, "sql": sql}))
+    return ("\n".join(lines * rounds) + "\n").encode()
+
+
+def run(command: str, requests: bytes) -> tuple[float, int, int]:
+    """Return (seconds, records, output bytes) for one batch run."""
+    start = time.perf_counter()
+    result = subprocess.run(
+        shlex.split(command) + ["--batch"],
+        input=requests,
+        capture_output=True,
+    )
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        sys.exit(f"{command} failed: {result.stderr.decode().strip()}")
+    return elapsed, result.stdout.count(b"\n"), len(result.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--rounds", type=int, default=200)
+    parser.add_argument("commands", nargs="*",
+                        default=[str(ROOT / "build" / "dump_ast")])
+    args = parser.parse_args()
+
+    requests = load_requests(args.rounds)
+    baseline = None
+    for command in args.commands:
+        elapsed, records, nbytes = run(command, requests)
+        line = (f"{command}: {records} statements in {elapsed:.3f}s, "
+                f"{records / elapsed:,.0f} stmt/s, "
+                f"{elapsed / records * 1e6:.1f} us/stmt, "
+                f"{nbytes / elapsed / 1e6:.1f} MB/s out")
+        if baseline is None:
+            baseline = elapsed
+        else:
+            line += f" ({baseline / elapsed:.2f}x vs first)"
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,187 @@
+/*
+** bench_parse.c - parse throughput and allocation benchmark
+**
+** Parses the SQL of every test case in ast-tests.ndjson through one handle,
+** round after round, with three lookaside configurations on the handle's
+** connection: none, SQLite's default, and the larger one sqlite_ast_open()
+** sets up (AST_LOOKASIDE_SIZE x AST_LOOKASIDE_COUNT). For each it reports
+** the time per statement, heap allocations per statement (counted with
+** wrapper sqlite3_mem_methods) and the lookaside hits and misses.
+**
+** Usage: bench_parse [bundle.ndjson] [rounds]
+**   Defaults to sqlite_ast_conformance/ast-tests.ndjson and 200 rounds.
+*/
+
+#include "../sqlite_ast.c"
+
+/* For its JSON string decoder, used to read the bundle */
+#define main dump_ast_main
+#include "../dump_ast.c"
+#undef main
+
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ================================================================
+ * Allocation counting
+ * ================================================================ */
+
+static sqlite3_mem_methods g_mem;   /* SQLite's own allocator */
+static long g_nAlloc;               /* xMalloc and xRealloc calls */
+
+static void *count_malloc(int n) {
+    g_nAlloc++;
+    return g_mem.xMalloc(n);
+}
+
+static void *count_realloc(void *p, int n) {
+    g_nAlloc++;
+    return g_mem.xRealloc(p, n);
+}
+
+/* Must run before SQLite is initialized by the first sqlite_ast_open() */
+static void count_allocations(void) {
+    sqlite3_mem_methods m;
+    sqlite3_config(SQLITE_CONFIG_GETMALLOC, &g_mem);
+    m = g_mem;
+    m.xMalloc = count_malloc;
+    m.xRealloc = count_realloc;
+    sqlite3_config(SQLITE_CONFIG_MALLOC, &m);
+}
+
+/* ================================================================
+ * Input
+ * ================================================================ */
+
+/* Read the "sql" of every case in a bundle. Returns the count, or -1. */
+static int read_bundle_sql(const char *zPath, char ***pazSql) {
+    FILE *f = fopen(zPath, "rb");
+    if (f == NULL) return -1;
+    char **azSql = NULL;
+    int nSql = 0;
+    char *zLine = NULL;
+    size_t nLine = 0;
+    ssize_t n;
+
+    /* The first line is the index */
+    if (getline(&zLine, &nLine, f) < 0) {
+        fclose(f);
+        return -1;
+    }
+    while ((n = getline(&zLine, &nLine, f)) > 0) {
+        const char *p = strstr(zLine, "\"sql\":");
+        char *zSql = malloc((size_t)n + 1);
+        int nOut = 0;
+        if (p) p = js_string(js_ws(p + 6), zSql, &nOut);
+        if (p == NULL) {
+            free(zSql);
+            continue;
+        }
+        zSql[nOut] = 0;
+        azSql = realloc(azSql, (nSql + 1) * sizeof(char *));
+        azSql[nSql++] = zSql;
+    }
+    free(zLine);
+    fclose(f);
+    *pazSql = azSql;
+    return nSql;
+}
+
+/* ================================================================
+ * Benchmark
+ * ================================================================ */
+
+static int lookaside_stat(sqlite3 *db, int op) {
+    int cur = 0, hiwtr = 0;
+    sqlite3_db_status(db, op, &cur, &hiwtr, 1);
+    return hiwtr;
+}
+
+/*
+** Parse every statement nRound times with the given lookaside slots on a
+** fresh handle and print one line of results.
+*/
+static int bench_config(const char *zName, int sz, int cnt,
+                        char **azSql, int nSql, int nRound) {
+    sqlite_ast *h;
+    if (sqlite_ast_open(SQLITE_AST_COMPACT, &h) != SQLITE_AST_OK) {
+        fprintf(stderr, "Failed to open parser\n");
+        return 1;
+    }
+    if (sqlite3_db_config(h->db, SQLITE_DBCONFIG_LOOKASIDE, NULL, sz, cnt)
+        != SQLITE_OK) {
+        printf("  %-22s could not configure lookaside\n", zName);
+        sqlite_ast_close(h);
+        return 0;
+    }
+
+    /* One untimed round, so the JSON buffer and task stack are grown */
+    for (int i = 0; i < nSql; i++) {
+        const char *zOut;
+        sqlite_ast_parse(h, azSql[i], -1, &zOut, NULL);
+    }
+
+    lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_HIT);
+    lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE);
+    lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL);
+    long nAlloc = g_nAlloc;
+    double start = now();
+    for (int r = 0; r < nRound; r++) {
+        for (int i = 0; i < nSql; i++) {
+            const char *zOut;
+            sqlite_ast_parse(h, azSql[i], -1, &zOut, NULL);
+        }
+    }
+    double elapsed = now() - start;
+    double nStmt = (double)nSql * nRound;
+    nAlloc = g_nAlloc - nAlloc;
+    int nHit = lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_HIT);
+    int nMissSize = lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE);
+    int nMissFull = lookaside_stat(h->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL);
+
+    printf("  %-22s %7.0f ns/stmt %9.0f stmts/s %7.1f mallocs/stmt"
+           "  lookaside %.1f hit, %.1f too big, %.1f full per stmt\n",
+           zName, elapsed / nStmt * 1e9, nStmt / elapsed, nAlloc / nStmt,
+           nHit / nStmt, nMissSize / nStmt, nMissFull / nStmt);
+    sqlite_ast_close(h);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *zPath = argc > 1 ? argv[1]
+        : "sqlite_ast_conformance/ast-tests.ndjson";
+    int nRound = argc > 2 ? atoi(argv[2]) : 200;
+    char **azSql = NULL;
+    char zName[64];
+
+    count_allocations();
+    int nSql = read_bundle_sql(zPath, &azSql);
+    if (nSql <= 0) {
+        fprintf(stderr, "Could not read test cases from %s\n", zPath);
+        return 1;
+    }
+
+    printf("%s: %d statements x %d rounds\n", zPath, nSql, nRound);
+    if (bench_config("no lookaside", 0, 0, azSql, nSql, nRound)) return 1;
+    snprintf(zName, sizeof(zName), "default (%dx%d)",
+             sqlite3GlobalConfig.szLookaside, sqlite3GlobalConfig.nLookaside);
+    if (bench_config(zName, sqlite3GlobalConfig.szLookaside,
+                     sqlite3GlobalConfig.nLookaside, azSql, nSql, nRound)) {
+        return 1;
+    }
+    snprintf(zName, sizeof(zName), "sqlite_ast (%dx%d)",
+             AST_LOOKASIDE_SIZE, AST_LOOKASIDE_COUNT);
+    if (bench_config(zName, AST_LOOKASIDE_SIZE, AST_LOOKASIDE_COUNT,
+                     azSql, nSql, nRound)) {
+        return 1;
+    }
+
+    for (int i = 0; i < nSql; i++) free(azSql[i]);
+    free(azSql);
+    return 0;
+}
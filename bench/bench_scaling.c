@@ -0,0 +1,370 @@
+/*
+** bench_scaling.c - parse + serialize scaling benchmark
+**
+** Generates families of queries, each parameterized by a size n (columns
+** in a SELECT list, values in an IN list, terms in a UNION ALL chain,
+** ...), and measures how the cost of parsing and serializing each one
+** grows with n: time per statement, output bytes per second and heap
+** allocations per statement. Time and allocations should grow linearly;
+** a family whose cost grows faster between its two largest sizes is
+** flagged as super-linear.
+**
+** Results are written to stdout as one JSON object, so runs can be stored
+** and compared; a readable table goes to stderr.
+**
+** Usage: bench_scaling [-t SECONDS] [FAMILY ...]
+**   -t   minimum time spent measuring each size (default 0.2)
+**   Runs every family unless some are named.
+*/
+
+#include "../sqlite_ast.c"
+
+#include <math.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+** A family is flagged when time or allocations per statement grow faster
+** than n^SUPERLINEAR_EXPONENT between its two largest sizes.
+*/
+#define SUPERLINEAR_EXPONENT 1.25
+
+/* ================================================================
+ * Allocation counting
+ * ================================================================ */
+
+static sqlite3_mem_methods g_mem;   /* SQLite's own allocator */
+static long g_nAlloc;               /* xMalloc and xRealloc calls */
+
+static void *count_malloc(int n) {
+    g_nAlloc++;
+    return g_mem.xMalloc(n);
+}
+
+static void *count_realloc(void *p, int n) {
+    g_nAlloc++;
+    return g_mem.xRealloc(p, n);
+}
+
+/* Must run before SQLite is initialized by the first sqlite_ast_open() */
+static void count_allocations(void) {
+    sqlite3_mem_methods m;
+    sqlite3_config(SQLITE_CONFIG_GETMALLOC, &g_mem);
+    m = g_mem;
+    m.xMalloc = count_malloc;
+    m.xRealloc = count_realloc;
+    sqlite3_config(SQLITE_CONFIG_MALLOC, &m);
+}
+
+/* ================================================================
+ * Query Families
+ *
+ * Each generator appends the query of size n to a Sql buffer. Sizes stay
+ * within SQLite's default limits of 1000 levels of expression and 200
+ * tables in a FROM clause. UNION ALL chains go past the limit of 500
+ * terms in a compound SELECT: the error the parser records for it does
+ * not stop the tree from being captured, and a captured tree is output.
+ * ================================================================ */
+
+typedef struct Sql {
+    char *z;
+    size_t n;
+    size_t cap;
+} Sql;
+
+static void sql_printf(Sql *p, const char *zFormat, ...) {
+    va_list ap;
+    for (;;) {
+        va_start(ap, zFormat);
+        int n = vsnprintf(p->z + p->n, p->cap - p->n, zFormat, ap);
+        va_end(ap);
+        if (p->n + (size_t)n < p->cap) {
+            p->n += (size_t)n;
+            return;
+        }
+        p->cap = p->cap ? p->cap * 2 : 4096;
+        p->z = realloc(p->z, p->cap);
+        if (p->z == NULL) {
+            fprintf(stderr, "Out of memory generating SQL\n");
+            exit(1);
+        }
+    }
+}
+
+/* SELECT c0, c1, ... FROM t */
+static void gen_wide_select(Sql *p, int n) {
+    sql_printf(p, "SELECT c0");
+    for (int i = 1; i < n; i++) sql_printf(p, ", c%d", i);
+    sql_printf(p, " FROM t");
+}
+
+/* SELECT * FROM t WHERE a IN (0, 1, ...) */
+static void gen_in_list(Sql *p, int n) {
+    sql_printf(p, "SELECT * FROM t WHERE a IN (0");
+    for (int i = 1; i < n; i++) sql_printf(p, ", %d", i);
+    sql_printf(p, ")");
+}
+
+/* SELECT a + 1 + 1 + ..., a tree n levels deep */
+static void gen_deep_expression(Sql *p, int n) {
+    sql_printf(p, "SELECT a");
+    for (int i = 1; i < n; i++) sql_printf(p, " + 1");
+}
+
+/* SELECT 0 UNION ALL SELECT 1 UNION ALL ... */
+static void gen_union_all(Sql *p, int n) {
+    sql_printf(p, "SELECT 0");
+    for (int i = 1; i < n; i++) sql_printf(p, " UNION ALL SELECT %d", i);
+}
+
+/* SELECT (SELECT 0 UNION ALL ... SELECT 15), ... : n 16-arm compounds */
+static void gen_compound_subqueries(Sql *p, int n) {
+    for (int i = 0; i < n; i++) {
+        sql_printf(p, i ? ", (SELECT 0" : "SELECT (SELECT 0");
+        for (int j = 1; j < 16; j++) sql_printf(p, " UNION ALL SELECT %d", j);
+        sql_printf(p, ")");
+    }
+}
+
+/* SELECT * FROM t0 JOIN t1 ON t1.id = t0.id JOIN ... */
+static void gen_joins(Sql *p, int n) {
+    sql_printf(p, "SELECT * FROM t0");
+    for (int i = 1; i < n; i++) {
+        sql_printf(p, " JOIN t%d ON t%d.id = t%d.id", i, i, i - 1);
+    }
+}
+
+/* WITH c0 AS (SELECT 0), c1 AS (SELECT * FROM c0), ... SELECT * FROM cN */
+static void gen_ctes(Sql *p, int n) {
+    sql_printf(p, "WITH c0 AS (SELECT 0)");
+    for (int i = 1; i < n; i++) {
+        sql_printf(p, ", c%d AS (SELECT * FROM c%d)", i, i - 1);
+    }
+    sql_printf(p, " SELECT * FROM c%d", n - 1);
+}
+
+/* SELECT sum(a) OVER w0 FROM t WINDOW w0 AS (...), w1 AS (...), ... */
+static void gen_window_definitions(Sql *p, int n) {
+    sql_printf(p, "SELECT sum(a) OVER w0 FROM t WINDOW w0 AS (ORDER BY a)");
+    for (int i = 1; i < n; i++) {
+        sql_printf(p, ", w%d AS (PARTITION BY b%d ORDER BY a "
+                      "ROWS BETWEEN %d PRECEDING AND CURRENT ROW)", i, i, i);
+    }
+}
+
+#define MAX_SIZES 8
+
+static const struct Family {
+    const char *zName;
+    void (*xGen)(Sql *p, int n);
+    int aSize[MAX_SIZES];       /* increasing, 0-terminated */
+} aFamily[] = {
+    { "wide_select",         gen_wide_select,          { 16, 64, 256, 1024 } },
+    { "in_list",             gen_in_list,              { 16, 256, 4096, 65536 } },
+    { "deep_expression",     gen_deep_expression,      { 8, 32, 128, 512 } },
+    { "union_all",           gen_union_all,            { 4, 16, 64, 256, 1024, 10000 } },
+    { "compound_subqueries", gen_compound_subqueries,  { 4, 16, 64, 256, 1024 } },
+    { "joins",               gen_joins,                { 3, 12, 48, 192 } },
+    { "ctes",                gen_ctes,                 { 4, 16, 64, 256, 1024 } },
+    { "window_definitions",  gen_window_definitions,   { 4, 16, 64, 256, 1024 } },
+};
+
+/* ================================================================
+ * Measurement
+ * ================================================================ */
+
+typedef struct Point {
+    int n;
+    size_t nSql;          /* bytes of SQL */
+    size_t nOut;          /* bytes of JSON */
+    long nIter;
+    double nsPerStmt;
+    double allocsPerStmt;
+} Point;
+
+/*
+** Parse zSql repeatedly for at least tMin seconds. Returns 0 on success,
+** or 1 if it fails to parse.
+*/
+static int measure(sqlite_ast *h, const char *zSql, double tMin, Point *pt) {
+    const char *zOut;
+    size_t nOut;
+
+    /* One untimed parse, so buffers have grown to size */
+    if (sqlite_ast_parse(h, zSql, -1, &zOut, &nOut) != SQLITE_AST_OK) {
+        return 1;
+    }
+    long nAlloc = g_nAlloc;
+    long nIter = 0;
+    double start = now();
+    double elapsed;
+    do {
+        sqlite_ast_parse(h, zSql, -1, &zOut, &nOut);
+        nIter++;
+        elapsed = now() - start;
+    } while (elapsed < tMin || nIter < 3);
+
+    pt->nOut = nOut;
+    pt->nIter = nIter;
+    pt->nsPerStmt = elapsed / nIter * 1e9;
+    pt->allocsPerStmt = (double)(g_nAlloc - nAlloc) / nIter;
+    return 0;
+}
+
+/* Growth exponent k in cost ~ n^k between points a and b */
+static double growth_exponent(double costA, double costB, int nA, int nB) {
+    if (costA <= 0 || costB <= 0) return 0;
+    return log(costB / costA) / log((double)nB / nA);
+}
+
+/* ================================================================
+ * Main Program
+ * ================================================================ */
+
+static int wanted(const char *zName, int nArg, char **azArg) {
+    if (nArg == 0) return 1;
+    for (int i = 0; i < nArg; i++) {
+        if (strcmp(azArg[i], zName) == 0) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double tMin = 0.2;
+    int iArg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+        tMin = atof(argv[2]);
+        iArg = 3;
+    }
+    for (int i = iArg; i < argc; i++) {
+        int found = 0;
+        for (size_t j = 0; j < sizeof(aFamily) / sizeof(aFamily[0]); j++) {
+            if (strcmp(argv[i], aFamily[j].zName) == 0) found = 1;
+        }
+        if (!found) {
+            fprintf(stderr, "Usage: bench_scaling [-t SECONDS] [FAMILY ...]\n");
+            fprintf(stderr, "Families:");
+            for (size_t j = 0; j < sizeof(aFamily) / sizeof(aFamily[0]); j++) {
+                fprintf(stderr, " %s", aFamily[j].zName);
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    count_allocations();
+    sqlite_ast *h;
+    if (sqlite_ast_open(SQLITE_AST_COMPACT, &h) != SQLITE_AST_OK) {
+        fprintf(stderr, "Failed to open parser\n");
+        return 1;
+    }
+
+    JsonWriter out = {0};
+    char zBuf[64];
+    jw_init(&out);
+    jw_obj_start(&out);
+    jw_key_n(&out, "sqlite_source_id", 16);
+    jw_str(&out, sqlite_ast_sourceid());
+    jw_key_n(&out, "serializer_version", 18);
+    jw_int(&out, SQLITE_AST_SERIALIZER_VERSION);
+    jw_key_n(&out, "superlinear_exponent", 20);
+    jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%g", SUPERLINEAR_EXPONENT));
+    jw_key_n(&out, "families", 8);
+    jw_arr_start(&out);
+
+    int nSuperlinear = 0;
+    fprintf(stderr, "%-20s %7s %12s %10s %12s %9s\n",
+            "family", "n", "ns/stmt", "MB/s", "allocs/stmt", "bytes");
+    for (size_t f = 0; f < sizeof(aFamily) / sizeof(aFamily[0]); f++) {
+        const struct Family *pFam = &aFamily[f];
+        Point aPoint[MAX_SIZES];
+        int nPoint = 0;
+
+        if (!wanted(pFam->zName, argc - iArg, argv + iArg)) continue;
+        for (int i = 0; i < MAX_SIZES && pFam->aSize[i]; i++) {
+            Sql sql = {0};
+            Point *pt = &aPoint[nPoint];
+            pFam->xGen(&sql, pFam->aSize[i]);
+            pt->n = pFam->aSize[i];
+            pt->nSql = sql.n;
+            if (measure(h, sql.z, tMin, pt)) {
+                fprintf(stderr, "%s n=%d: %s\n", pFam->zName, pt->n,
+                        sqlite_ast_errmsg(h));
+                free(sql.z);
+                return 1;
+            }
+            free(sql.z);
+            fprintf(stderr, "%-20s %7d %12.0f %10.1f %12.1f %9zu\n",
+                    pFam->zName, pt->n, pt->nsPerStmt,
+                    pt->nOut / pt->nsPerStmt * 1e3, pt->allocsPerStmt,
+                    pt->nOut);
+            nPoint++;
+        }
+
+        /* Growth between the two largest sizes, where fixed costs matter least */
+        const Point *a = &aPoint[nPoint - 2];
+        const Point *b = &aPoint[nPoint - 1];
+        double kTime = growth_exponent(a->nsPerStmt, b->nsPerStmt, a->n, b->n);
+        double kAlloc = growth_exponent(a->allocsPerStmt, b->allocsPerStmt,
+                                        a->n, b->n);
+        int superlinear = kTime > SUPERLINEAR_EXPONENT
+                       || kAlloc > SUPERLINEAR_EXPONENT;
+        if (superlinear) {
+            nSuperlinear++;
+            fprintf(stderr, "%-20s SUPER-LINEAR: time ~ n^%.2f, allocations ~ n^%.2f\n",
+                    pFam->zName, kTime, kAlloc);
+        }
+
+        jw_obj_start(&out);
+        jw_key_n(&out, "name", 4);
+        jw_str(&out, pFam->zName);
+        jw_key_n(&out, "points", 6);
+        jw_arr_start(&out);
+        for (int i = 0; i < nPoint; i++) {
+            const Point *pt = &aPoint[i];
+            jw_obj_start(&out);
+            jw_key_n(&out, "n", 1);
+            jw_int(&out, pt->n);
+            jw_key_n(&out, "sql_bytes", 9);
+            jw_int(&out, (int)pt->nSql);
+            jw_key_n(&out, "output_bytes", 12);
+            jw_int(&out, (int)pt->nOut);
+            jw_key_n(&out, "iterations", 10);
+            jw_int(&out, (int)pt->nIter);
+            jw_key_n(&out, "ns_per_stmt", 11);
+            jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%.1f", pt->nsPerStmt));
+            jw_key_n(&out, "bytes_per_sec", 13);
+            jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%.0f",
+                                              pt->nOut / pt->nsPerStmt * 1e9));
+            jw_key_n(&out, "allocs_per_stmt", 15);
+            jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%.2f", pt->allocsPerStmt));
+            jw_obj_end(&out);
+        }
+        jw_arr_end(&out);
+        jw_key_n(&out, "time_exponent", 13);
+        jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%.3f", kTime));
+        jw_key_n(&out, "alloc_exponent", 14);
+        jw_value_raw(&out, zBuf, snprintf(zBuf, sizeof(zBuf), "%.3f", kAlloc));
+        jw_key_n(&out, "superlinear", 11);
+        jw_bool(&out, superlinear);
+        jw_obj_end(&out);
+    }
+
+    jw_arr_end(&out);
+    jw_obj_end(&out);
+    JW_LIT(&out, "\n");
+    fwrite(out.buf, 1, out.pos, stdout);
+    if (nSuperlinear) {
+        fprintf(stderr, "%d famil%s with super-linear cost\n",
+                nSuperlinear, nSuperlinear == 1 ? "y" : "ies");
+    }
+
+    free(out.buf);
+    sqlite_ast_close(h);
+    return 0;
+}
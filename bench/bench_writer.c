@@ -0,0 +1,168 @@
+/*
+** bench_writer.c - JSON writer microbenchmark
+**
+** Parses one fixture's SQL once, then re-serializes the captured Select in
+** a tight loop in both pretty and compact mode. Parsing is excluded from the
+** timings, so this measures the AST walk and the JSON writer alone.
+**
+** A second run serializes a query made of large string and blob literals
+** with each string-escaping scanner in turn, to measure escaping
+** throughput on its own.
+**
+** Usage: bench_writer [fixture.json] [iterations]
+**   Defaults to the kitchen_sink fixture and 20000 iterations.
+*/
+
+#include "../sqlite_ast.c"
+
+/* For its JSON string decoder, used to read the fixture */
+#define main dump_ast_main
+#include "../dump_ast.c"
+#undef main
+
+#include <time.h>
+
+static long g_iterations;
+static double g_elapsed;
+static size_t g_tree_bytes;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Capture action that serializes the same tree g_iterations times */
+static void capture_bench(AstCtx *c, Select *p) {
+    JsonWriter *w = (JsonWriter *)c->pEmitArg;
+    double start = now();
+    for (long i = 0; i < g_iterations; i++) {
+        w->pos = 0;
+        jw_init(w);
+        serialize_select(c, p);
+    }
+    g_elapsed = now() - start;
+    g_tree_bytes = w->pos;
+}
+
+/*
+** Build SELECT '<text>', X'<hex>' with nBytes of mostly clean prose in the
+** string (a newline every 80 bytes and the odd double quote, both of which
+** need escaping) and nBytes of hex digits in the blob.
+*/
+static char *large_literal_sql(size_t nBytes) {
+    static const char zProse[] =
+        "The \"quick\" brown fox jumps over the lazy dog, then does it again. ";
+    char *zSql = malloc(nBytes * 2 + 32);
+    char *z = zSql;
+    memcpy(z, "SELECT '", 8);
+    z += 8;
+    for (size_t i = 0; i < nBytes; i++) {
+        *z++ = (i % 80 == 79) ? '\n' : zProse[i % (sizeof(zProse) - 1)];
+    }
+    memcpy(z, "', X'", 5);
+    z += 5;
+    for (size_t i = 0; i < nBytes; i++) *z++ = "0123456789abcdef"[i % 16];
+    memcpy(z, "'", 2);
+    return zSql;
+}
+
+/* Read the "sql" string out of a fixture file */
+static char *read_fixture_sql(const char *zPath) {
+    FILE *f = fopen(zPath, "rb");
+    if (f == NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *zJson = malloc((size_t)n + 1);
+    char *zSql = malloc((size_t)n + 1);
+    size_t got = fread(zJson, 1, (size_t)n, f);
+    fclose(f);
+    zJson[got] = 0;
+
+    const char *p = strstr(zJson, "\"sql\"");
+    int nSql = 0;
+    if (p) p = js_ws(p + 5);
+    if (p && *p == ':') p = js_string(js_ws(p + 1), zSql, &nSql);
+    free(zJson);
+    if (p == NULL) {
+        free(zSql);
+        return NULL;
+    }
+    zSql[nSql] = 0;
+    return zSql;
+}
+
+int main(int argc, char **argv) {
+    const char *zPath = argc > 1 ? argv[1]
+        : "sqlite_ast_conformance/ast-tests/kitchen_sink.json";
+    g_iterations = argc > 2 ? atol(argv[2]) : 20000;
+
+    char *zSql = read_fixture_sql(zPath);
+    if (zSql == NULL) {
+        fprintf(stderr, "Could not read \"sql\" from %s\n", zPath);
+        return 1;
+    }
+
+    sqlite_ast *h;
+    if (sqlite_ast_open(0, &h) != SQLITE_AST_OK) {
+        fprintf(stderr, "Failed to open parser\n");
+        return 1;
+    }
+
+    h->ctx.xCapture = capture_bench;
+    printf("%s: %ld iterations\n", zPath, g_iterations);
+    for (int compact = 0; compact <= 1; compact++) {
+        h->flags = compact ? SQLITE_AST_COMPACT : 0;
+        if (ast_parse_json(h, zSql, -1) != SQLITE_AST_OK) {
+            fprintf(stderr, "%s\n", sqlite_ast_errmsg(h));
+            return 1;
+        }
+        printf("  %-8s %9.0f ns/tree  %8.1f MB/s  (%zu bytes/tree)\n",
+               compact ? "compact" : "pretty",
+               g_elapsed / g_iterations * 1e9,
+               g_tree_bytes * g_iterations / g_elapsed / 1e6,
+               g_tree_bytes);
+    }
+
+    static const struct {
+        const char *zName;
+        const unsigned char *(*xScan)(const unsigned char *);
+    } aScan[] = {
+        { "scalar", jw_scan_scalar },
+#if defined(__SSE2__)
+        { "sse2", jw_scan_sse2 },
+#endif
+#if defined(JW_HAVE_AVX2)
+        { "avx2", jw_scan_avx2 },
+#endif
+    };
+    size_t nLiteral = 256 * 1024;
+    char *zLiteralSql = large_literal_sql(nLiteral);
+    g_iterations = 2000;
+    h->flags = SQLITE_AST_COMPACT;
+    printf("large literals: 2 x %zu KB, %ld iterations\n",
+           nLiteral / 1024, g_iterations);
+    for (size_t i = 0; i < sizeof(aScan) / sizeof(aScan[0]); i++) {
+#if defined(JW_HAVE_AVX2)
+        if (aScan[i].xScan == jw_scan_avx2 && !__builtin_cpu_supports("avx2")) {
+            continue;
+        }
+#endif
+        jw_scan = aScan[i].xScan;
+        if (ast_parse_json(h, zLiteralSql, -1) != SQLITE_AST_OK) {
+            fprintf(stderr, "%s\n", sqlite_ast_errmsg(h));
+            return 1;
+        }
+        printf("  %-8s %9.0f ns/tree  %8.1f MB/s  (%zu bytes/tree)\n",
+               aScan[i].zName,
+               g_elapsed / g_iterations * 1e9,
+               g_tree_bytes * g_iterations / g_elapsed / 1e6,
+               g_tree_bytes);
+    }
+
+    sqlite_ast_close(h);
+    free(zLiteralSql);
+    free(zSql);
+    return 0;
+}
@@ -1,1070 +1,913 @@
 /*
-** dump_ast.c - SQLite SELECT AST to JSON serializer
+** dump_ast.c - SQLite SELECT AST to JSON command-line tool
 **
-** This program parses a SQL SELECT statement using the official SQLite parser
-** and outputs the raw (pre-resolution) AST as JSON. It works by hooking into
-** the parser's grammar action for "cmd ::= select(X)" to capture the Select*
-** before it is modified by sqlite3Select() or deleted.
+** A thin front end over libsqlite_ast (sqlite_ast.h), which parses a SQL
+** SELECT statement with the official SQLite parser and serializes the raw
+** (pre-resolution) AST as JSON.
 **
-** Build: see Makefile (patches sqlite3.c to insert the hook call)
+** Build: see Makefile
 **
-** Usage: dump_ast "SELECT 1"
-**   Outputs JSON AST to stdout.
+** Usage: dump_ast [--compact] "SELECT 1"
+**   Outputs JSON AST to stdout, pretty-printed unless --compact is given.
+**
+**        dump_ast --batch
+**   Reads NDJSON requests {"id": ..., "sql": "..."} from stdin and writes
+**   one compact JSON record per request to stdout, reusing one handle.
+**
+**        dump_ast --format=cbor ...
+**   Writes CBOR instead of JSON (see SQLITE_AST_CBOR): the bare AST for a
+**   single query, or a CBOR sequence of records in batch mode.
+**
+**        dump_ast --split ...
+**   Splits the SQL into statements (see sqlite_ast_split()) and writes
+**   one compact record per statement, {"offset": N, "ast": {...}} or
+**   {"offset": N, "error": "..."}, where offset is the byte offset of
+**   the statement in the SQL; in batch mode each record also has the id.
+**
+**        dump_ast --all "SQL"
+**   Parses every statement of the SQL in one pass (see SQLITE_AST_ALL)
+**   and writes a single array of those records, pretty-printed unless
+**   --compact is given.
+**
+**        dump_ast --input FILE ...
+**   Reads the SQL from FILE instead of the command line. The file is
+**   memory-mapped and parsed where it lies, so with --split a log of any
+**   size is processed in one pass with the records written as they are
+**   produced.
+**
+**        dump_ast --fingerprint ...
+**   Instead of the AST, outputs {"fingerprint": "<16 hex digits>", "shape":
+**   "..."} (see sqlite_ast_fingerprint()), which is the same for queries
+**   that differ only in their literals; in batch mode as a member of each
+**   record.
+**
+**        dump_ast --subtrees ...
+**   Also lists every node of the tree with its subtree hash (see
+**   sqlite_ast_subtrees()) as a JSON array of [hash, type, nodes]
+**   triples, children before parents: on stderr for a single query, or
+**   as a "subtrees" member of each batch record.
+**
+**        dump_ast --stats ...
+**   Also reports timings per phase, node counts by type, output size and
+**   memory high-water marks as a JSON object (see sqlite_ast_stats()): on
+**   stderr for a single query, or as a "stats" member of each batch record.
+**
+**        dump_ast --version
+**   Prints {"serializer_version": N, "sqlite_source_id": "..."}, which
+**   together identify the output produced for any given input.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* ----------------------------------------------------------------
- * Forward declaration of the hook function.
- * The patched amalgamation calls this from the grammar action
- * for "cmd ::= select(X)", passing the Select* as void*.
- * ---------------------------------------------------------------- */
-void ast_capture_hook(void *select_ptr);
-
-/* ----------------------------------------------------------------
- * Include the patched SQLite amalgamation.
- * This gives us access to all internal types (Select, Expr, etc.)
- * ---------------------------------------------------------------- */
-#include "build/sqlite3_patched.c"
+#include "sqlite_ast.h"
 
 /* ================================================================
- * JSON Writer (pretty-printed with 2-space indentation)
- *
- * State machine:
- *   g_need_comma: next element needs a preceding comma
- *   g_after_key:  we just wrote "key": and the value follows inline
- *   g_indent:     current nesting depth for indentation
+ * Output
  * ================================================================ */
 
-static char g_buf[4 * 1024 * 1024]; /* 4MB output buffer */
-static int g_pos;
-static int g_need_comma;
-static int g_after_key;
-static int g_indent;
-
-static void jw_init(void) {
-    g_pos = 0;
-    g_buf[0] = 0;
-    g_need_comma = 0;
-    g_after_key = 0;
-    g_indent = 0;
+/* sqlite_ast_write_fn that appends to a stdio stream */
+static int write_file(void *pArg, const char *z, size_t n) {
+    return fwrite(z, 1, n, (FILE *)pArg) == n ? 0 : 1;
 }
 
-static void jw_raw(const char *s) {
-    int len = (int)strlen(s);
-    if (g_pos + len < (int)sizeof(g_buf) - 1) {
-        memcpy(g_buf + g_pos, s, len);
-        g_pos += len;
-        g_buf[g_pos] = 0;
+/* Write s to stdout as a quoted JSON string */
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            putchar('\\');
+            putchar(*p);
+        } else if (*p < 0x20) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
     }
+    putchar('"');
 }
 
-static void jw_rawf(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap, fmt);
-    int n = vsnprintf(g_buf + g_pos, sizeof(g_buf) - g_pos, fmt, ap);
-    va_end(ap);
-    if (n > 0) g_pos += n;
-}
-
-static void jw_newline(void) {
-    jw_raw("\n");
-    for (int i = 0; i < g_indent; i++) jw_raw("  ");
-}
+/* ================================================================
+ * Input Files (--input)
+ *
+ * The file is mapped into memory whole and parsed where it lies. The
+ * mapping is placed at the start of a zero-filled anonymous one at least
+ * a byte longer, so the text is followed by the NUL byte the tokenizer
+ * needs even when the file ends on a page boundary. Pages are read in as
+ * the parser reaches them and, with --split, dropped from the process
+ * once every statement in them has been parsed, so memory use stays flat
+ * however large the file is. Anything that cannot be mapped, such as a
+ * pipe, is read into memory instead.
+ * ================================================================ */
 
-/*
-** Before writing a new element (value, object, or array), call this
-** to handle commas and newlines. After a key, values go inline.
-*/
-static void jw_element_prefix(void) {
-    if (g_after_key) {
-        g_after_key = 0;
-        /* Value follows "key": inline, no newline */
-    } else {
-        if (g_need_comma) jw_raw(",");
-        jw_newline();
+/* SQL text read with --input */
+typedef struct InputText {
+    char *z;          /* the text, followed by a NUL */
+    size_t n;         /* bytes of text */
+    size_t nMap;      /* bytes mapped, or 0 if z was allocated */
+    size_t nDone;     /* bytes at the start whose pages were released */
+} InputText;
+
+/* Pages of a mapping are released in steps of this many bytes */
+#define INPUT_RELEASE_STEP (16 << 20)
+
+/* Open zPath into *pIn. Returns 0, or 1 after printing an error */
+static int input_open(const char *zPath, InputText *pIn) {
+    int fd = open(zPath, O_RDONLY);
+    struct stat st;
+
+    memset(pIn, 0, sizeof(*pIn));
+    if (fd < 0) {
+        fprintf(stderr, "dump_ast: %s: %s\n", zPath, strerror(errno));
+        return 1;
     }
-    g_need_comma = 0;
-}
-
-/* Write a JSON-escaped string (with quotes) - raw, no prefix handling */
-static void jw_quoted_string(const char *s) {
-    jw_raw("\"");
-    if (s) {
-        for (const char *p = s; *p; p++) {
-            switch (*p) {
-                case '"':  jw_raw("\\\""); break;
-                case '\\': jw_raw("\\\\"); break;
-                case '\b': jw_raw("\\b");  break;
-                case '\f': jw_raw("\\f");  break;
-                case '\n': jw_raw("\\n");  break;
-                case '\r': jw_raw("\\r");  break;
-                case '\t': jw_raw("\\t");  break;
-                default:
-                    if ((unsigned char)*p < 0x20) {
-                        jw_rawf("\\u%04x", (unsigned char)*p);
-                    } else {
-                        char c[2] = {*p, 0};
-                        jw_raw(c);
-                    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t nPage = (size_t)sysconf(_SC_PAGESIZE);
+        size_t nMap = ((size_t)st.st_size / nPage + 1) * nPage;
+        char *z = mmap(NULL, nMap, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (z != MAP_FAILED && st.st_size > 0
+            && mmap(z, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+                   == MAP_FAILED) {
+            munmap(z, nMap);
+            z = MAP_FAILED;
+        }
+        if (z != MAP_FAILED) {
+            madvise(z, nMap, MADV_SEQUENTIAL);
+            pIn->z = z;
+            pIn->n = (size_t)st.st_size;
+            pIn->nMap = nMap;
+        }
+    }
+    if (pIn->z == NULL) {
+        size_t nAlloc = 0;
+        for (;;) {
+            if (nAlloc - pIn->n < 65536 + 1) {
+                nAlloc = nAlloc ? nAlloc * 2 : 1 << 20;
+                char *z = realloc(pIn->z, nAlloc);
+                if (z == NULL) {
+                    fprintf(stderr, "dump_ast: %s: out of memory\n", zPath);
+                    free(pIn->z);
+                    close(fd);
+                    return 1;
+                }
+                pIn->z = z;
+            }
+            ssize_t n = read(fd, pIn->z + pIn->n, 65536);
+            if (n > 0) {
+                pIn->n += (size_t)n;
+            } else if (n == 0) {
+                break;
+            } else if (errno != EINTR) {
+                fprintf(stderr, "dump_ast: %s: %s\n", zPath, strerror(errno));
+                free(pIn->z);
+                close(fd);
+                return 1;
             }
         }
+        pIn->z[pIn->n] = 0;
     }
-    jw_raw("\"");
-}
-
-static void jw_obj_start(void) {
-    jw_element_prefix();
-    jw_raw("{");
-    g_indent++;
-    g_need_comma = 0;
-}
-
-static void jw_obj_end(void) {
-    g_indent--;
-    g_after_key = 0;
-    jw_newline();
-    jw_raw("}");
-    g_need_comma = 1;
-}
-
-static void jw_arr_start(void) {
-    jw_element_prefix();
-    jw_raw("[");
-    g_indent++;
-    g_need_comma = 0;
-}
-
-static void jw_arr_end(void) {
-    g_indent--;
-    g_after_key = 0;
-    jw_newline();
-    jw_raw("]");
-    g_need_comma = 1;
-}
-
-static void jw_key(const char *k) {
-    if (g_need_comma) jw_raw(",");
-    jw_newline();
-    jw_quoted_string(k);
-    jw_raw(": ");
-    g_need_comma = 0;
-    g_after_key = 1;
-}
-
-/* Write a string value */
-static void jw_str(const char *s) {
-    jw_element_prefix();
-    jw_quoted_string(s);
-    g_need_comma = 1;
-}
-
-/* Write a null value */
-static void jw_null(void) {
-    jw_element_prefix();
-    jw_raw("null");
-    g_need_comma = 1;
-}
-
-/* Write a boolean value */
-static void jw_bool(int v) {
-    jw_element_prefix();
-    jw_raw(v ? "true" : "false");
-    g_need_comma = 1;
-}
-
-/* Write an integer value */
-static void jw_int(int v) {
-    jw_element_prefix();
-    jw_rawf("%d", v);
-    g_need_comma = 1;
-}
-
-/* Convenience: write "key": "value" or "key": null (value inline) */
-static void jw_key_str(const char *k, const char *v) {
-    jw_key(k);
-    if (v) { jw_quoted_string(v); } else { jw_raw("null"); }
-    g_need_comma = 1;
-    g_after_key = 0;
+    close(fd);
+    return 0;
 }
 
-/* Convenience: write "key": true/false */
-static void jw_key_bool(const char *k, int v) {
-    jw_key(k);
-    jw_raw(v ? "true" : "false");
-    g_need_comma = 1;
-    g_after_key = 0;
+/*
+** Release the pages of a mapping that lie wholly before offset iOff,
+** which will not be read again. They are file pages that were never
+** written, so the kernel can drop them without writing anything.
+*/
+static void input_release(InputText *pIn, size_t iOff) {
+    if (pIn->nMap == 0 || iOff - pIn->nDone < INPUT_RELEASE_STEP) return;
+    size_t nPage = (size_t)sysconf(_SC_PAGESIZE);
+    size_t iEnd = iOff / nPage * nPage;
+    madvise(pIn->z + pIn->nDone, iEnd - pIn->nDone, MADV_DONTNEED);
+    pIn->nDone = iEnd;
 }
 
-/* Convenience: write "key": null */
-static void jw_key_null(const char *k) {
-    jw_key(k);
-    jw_raw("null");
-    g_need_comma = 1;
-    g_after_key = 0;
+static void input_close(InputText *pIn) {
+    if (pIn->nMap) {
+        munmap(pIn->z, pIn->nMap);
+    } else {
+        free(pIn->z);
+    }
 }
 
 /* ================================================================
- * AST Serialization - Forward Declarations
+ * Batch Mode - NDJSON requests on stdin, one record per line out
+ *
+ * Each input line is a JSON object {"id": ..., "sql": "..."}. The id is
+ * echoed back verbatim (any JSON value, null if absent) and each output
+ * line is either {"id":...,"ast":{...}} or {"id":...,"error":"..."}.
  * ================================================================ */
 
-static void json_expr(const Expr *pExpr);
-static void json_expr_list(const ExprList *pList);
-static void json_select(const Select *p);
-static void json_src_list(const SrcList *pSrc);
-static void json_id_list(const IdList *pList);
-static void json_with(const With *pWith);
-#ifndef SQLITE_OMIT_WINDOWFUNC
-static void json_window(const Window *pWin);
-#endif
+/* Buffered line reader over fd 0 */
+typedef struct LineReader {
+    char *buf;
+    size_t cap;
+    size_t start;   /* first byte of the current line */
+    size_t scan;    /* bytes before this offset contain no newline */
+    size_t end;     /* one past the last byte read */
+    int eof;
+} LineReader;
 
-/* ================================================================
- * AST Serialization - Expressions
- * ================================================================ */
-
-/* Map a TK_ binary operator to its SQL symbol */
-static const char *binop_name(int op) {
-    switch (op) {
-        case TK_AND:     return "AND";
-        case TK_OR:      return "OR";
-        case TK_LT:      return "<";
-        case TK_LE:      return "<=";
-        case TK_GT:      return ">";
-        case TK_GE:      return ">=";
-        case TK_EQ:      return "=";
-        case TK_NE:      return "!=";
-        case TK_IS:      return "IS";
-        case TK_ISNOT:   return "IS NOT";
-        case TK_PLUS:    return "+";
-        case TK_MINUS:   return "-";
-        case TK_STAR:    return "*";
-        case TK_SLASH:   return "/";
-        case TK_REM:     return "%";
-        case TK_BITAND:  return "&";
-        case TK_BITOR:   return "|";
-        case TK_LSHIFT:  return "<<";
-        case TK_RSHIFT:  return ">>";
-        case TK_CONCAT:  return "||";
-        case TK_LIKE_KW: return "LIKE";
-        case TK_MATCH:   return "MATCH";
-        default: return NULL;
-    }
-}
-
-static void json_expr(const Expr *pExpr) {
-    if (pExpr == NULL) {
-        jw_null();
-        return;
-    }
-
-    jw_obj_start();
-
-    switch (pExpr->op) {
-
-    case TK_INTEGER: {
-        jw_key_str("type", "integer");
-        jw_key("value");
-        if (pExpr->flags & EP_IntValue) {
-            jw_rawf("%d", pExpr->u.iValue);
-            g_need_comma = 1;
-        } else {
-            jw_str(pExpr->u.zToken);
+/*
+** Return the next line, NUL-terminated and without its newline, or NULL at
+** end of input; a read error ends the process. Output is flushed before
+** every blocking read so that an interactive client sees each record as
+** soon as its request is complete.
+*/
+static char *lr_next(LineReader *r, size_t *pLen) {
+    for (;;) {
+        char *nl = r->end > r->scan
+            ? memchr(r->buf + r->scan, '\n', r->end - r->scan) : NULL;
+        if (nl) {
+            char *line = r->buf + r->start;
+            *nl = 0;
+            *pLen = (size_t)(nl - line);
+            r->start = r->scan = (size_t)(nl - r->buf) + 1;
+            return line;
+        }
+        r->scan = r->end;
+        if (r->eof) {
+            if (r->start == r->end) return NULL;
+            /* Final line without a trailing newline */
+            char *line = r->buf + r->start;
+            r->buf[r->end] = 0;
+            *pLen = r->end - r->start;
+            r->start = r->scan = r->end;
+            return line;
         }
-        break;
-    }
-
-    case TK_FLOAT: {
-        jw_key_str("type", "float");
-        jw_key_str("value", pExpr->u.zToken);
-        break;
-    }
-
-    case TK_STRING: {
-        jw_key_str("type", "string");
-        jw_key_str("value", pExpr->u.zToken);
-        break;
-    }
-
-    case TK_BLOB: {
-        jw_key_str("type", "blob");
-        jw_key_str("value", pExpr->u.zToken);
-        break;
-    }
-
-    case TK_NULL: {
-        jw_key_str("type", "null");
-        break;
-    }
-
-    case TK_TRUEFALSE: {
-        jw_key_str("type", "boolean");
-        jw_key_bool("value", sqlite3ExprTruthValue(pExpr));
-        break;
-    }
-
-    case TK_ID: {
-        jw_key_str("type", "name");
-        jw_key_str("name", pExpr->u.zToken);
-        break;
-    }
-
-    case TK_DOT: {
-        jw_key_str("type", "dot");
-        jw_key("left");
-        json_expr(pExpr->pLeft);
-        jw_key("right");
-        json_expr(pExpr->pRight);
-        break;
-    }
-
-    case TK_ASTERISK: {
-        jw_key_str("type", "star");
-        break;
-    }
-
-    case TK_VARIABLE: {
-        jw_key_str("type", "parameter");
-        jw_key_str("name", pExpr->u.zToken);
-        break;
-    }
-
-    case TK_CAST: {
-        jw_key_str("type", "cast");
-        jw_key("expr");
-        json_expr(pExpr->pLeft);
-        jw_key_str("as", pExpr->u.zToken);
-        break;
-    }
 
-    case TK_CASE: {
-        jw_key_str("type", "case");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        if (pExpr->x.pList) {
-            int i;
-            jw_key("when_clauses");
-            jw_arr_start();
-            for (i = 0; i + 1 < pExpr->x.pList->nExpr; i += 2) {
-                jw_obj_start();
-                jw_key("when");
-                json_expr(pExpr->x.pList->a[i].pExpr);
-                jw_key("then");
-                json_expr(pExpr->x.pList->a[i + 1].pExpr);
-                jw_obj_end();
-            }
-            jw_arr_end();
-            /* The last item, if odd count, is ELSE */
-            if (pExpr->x.pList->nExpr % 2 == 1) {
-                jw_key("else");
-                json_expr(pExpr->x.pList->a[pExpr->x.pList->nExpr - 1].pExpr);
-            } else {
-                jw_key_null("else");
+        /* Move the partial line to the front, growing if it fills the buffer */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->scan -= r->start;
+            r->start = 0;
+        }
+        if (r->cap - r->end < 4096) {
+            size_t cap = r->cap ? r->cap * 2 : 65536;
+            char *buf = realloc(r->buf, cap);
+            if (buf == NULL) {
+                fprintf(stderr, "Out of memory reading input\n");
+                exit(1);
             }
+            r->buf = buf;
+            r->cap = cap;
         }
-        break;
-    }
-
-    case TK_BETWEEN: {
-        jw_key_str("type", "between");
-        jw_key("expr");
-        json_expr(pExpr->pLeft);
-        jw_key("low");
-        json_expr(pExpr->x.pList->a[0].pExpr);
-        jw_key("high");
-        json_expr(pExpr->x.pList->a[1].pExpr);
-        break;
-    }
 
-    case TK_IN: {
-        jw_key_str("type", "in");
-        jw_key("expr");
-        json_expr(pExpr->pLeft);
-        if (pExpr->flags & EP_xIsSelect) {
-            jw_key("select");
-            json_select(pExpr->x.pSelect);
-        } else {
-            jw_key("values");
-            json_expr_list(pExpr->x.pList);
+        fflush(stdout);
+        ssize_t n = read(0, r->buf + r->end, r->cap - r->end - 1);
+        if (n > 0) {
+            r->end += (size_t)n;
+        } else if (n == 0) {
+            r->eof = 1;
+        } else if (errno != EINTR) {
+            fprintf(stderr, "Error reading input: %s\n", strerror(errno));
+            exit(1);
         }
-        break;
     }
+}
 
-    case TK_EXISTS: {
-        jw_key_str("type", "exists");
-        jw_key("select");
-        json_select(pExpr->x.pSelect);
-        break;
-    }
+/* One decoded request line */
+typedef struct Request {
+    const char *zId;   /* raw JSON text of the id value */
+    int nId;
+    char *zSql;        /* decoded SQL text */
+    int nSql;
+} Request;
 
-    case TK_SELECT: {
-        jw_key_str("type", "subquery");
-        jw_key("select");
-        json_select(pExpr->x.pSelect);
-        break;
-    }
+static const char *js_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
 
-    case TK_COLLATE: {
-        jw_key_str("type", "collate");
-        jw_key("expr");
-        json_expr(pExpr->pLeft);
-        jw_key_str("collation", pExpr->u.zToken);
-        break;
+static int js_hex4(const char *p) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
     }
+    return v;
+}
 
-    case TK_FUNCTION:
-    case TK_AGG_FUNCTION: {
-        jw_key_str("type", "function");
-        jw_key_str("name", pExpr->u.zToken);
-        jw_key("args");
-        if (!ExprHasProperty(pExpr, EP_TokenOnly) && pExpr->x.pList) {
-            json_expr_list(pExpr->x.pList);
-        } else {
-            jw_arr_start();
-            jw_arr_end();
+/*
+** Decode the JSON string starting at the opening quote p. If zOut is not
+** NULL the decoded UTF-8 bytes are written there (never more bytes than
+** the escaped source) and their count stored in *pnOut. Returns a pointer
+** just past the closing quote, or NULL if the string is malformed.
+*/
+static const char *js_string(const char *p, char *zOut, int *pnOut) {
+    int n = 0;
+    if (*p++ != '"') return NULL;
+    for (;;) {
+        unsigned char c = (unsigned char)*p++;
+        if (c == '"') break;
+        if (c < 0x20) return NULL;
+        if (c != '\\') {
+            if (zOut) zOut[n] = (char)c;
+            n++;
+            continue;
         }
-        jw_key_bool("distinct",
-            (pExpr->flags & EP_Distinct) ? 1 : 0);
-        /* ORDER BY within aggregate function */
-        if (pExpr->pLeft && pExpr->pLeft->op == TK_ORDER) {
-            jw_key("order_by");
-            json_expr_list(pExpr->pLeft->x.pList);
+        unsigned int cp;
+        switch (*p++) {
+            case '"':  cp = '"';  break;
+            case '\\': cp = '\\'; break;
+            case '/':  cp = '/';  break;
+            case 'b':  cp = '\b'; break;
+            case 'f':  cp = '\f'; break;
+            case 'n':  cp = '\n'; break;
+            case 'r':  cp = '\r'; break;
+            case 't':  cp = '\t'; break;
+            case 'u': {
+                int v = js_hex4(p);
+                if (v < 0) return NULL;
+                p += 4;
+                cp = (unsigned int)v;
+                if (cp >= 0xDC00 && cp <= 0xDFFF) return NULL;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    int lo = (p[0] == '\\' && p[1] == 'u') ? js_hex4(p + 2) : -1;
+                    if (lo < 0xDC00 || lo > 0xDFFF) return NULL;
+                    p += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + ((unsigned int)lo - 0xDC00);
+                }
+                break;
+            }
+            default: return NULL;
         }
-#ifndef SQLITE_OMIT_WINDOWFUNC
-        if (IsWindowFunc(pExpr) && pExpr->y.pWin) {
-            jw_key("over");
-            json_window(pExpr->y.pWin);
+        if (zOut) {
+            if (cp < 0x80) {
+                zOut[n] = (char)cp;
+            } else if (cp < 0x800) {
+                zOut[n++] = (char)(0xC0 | (cp >> 6));
+                zOut[n] = (char)(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                zOut[n++] = (char)(0xE0 | (cp >> 12));
+                zOut[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                zOut[n] = (char)(0x80 | (cp & 0x3F));
+            } else {
+                zOut[n++] = (char)(0xF0 | (cp >> 18));
+                zOut[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                zOut[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                zOut[n] = (char)(0x80 | (cp & 0x3F));
+            }
+        } else if (cp >= 0x80) {
+            n += cp < 0x800 ? 1 : cp < 0x10000 ? 2 : 3;
         }
-#endif
-        break;
-    }
-
-    case TK_UMINUS: {
-        jw_key_str("type", "unary");
-        jw_key_str("op", "-");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
+        n++;
     }
+    if (pnOut) *pnOut = n;
+    return p;
+}
 
-    case TK_UPLUS: {
-        jw_key_str("type", "unary");
-        jw_key_str("op", "+");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
+/* Skip a number, true, false or null, returning a pointer past it or NULL */
+static const char *js_skip_literal(const char *p) {
+    static const char *azWord[] = { "true", "false", "null" };
+    for (int i = 0; i < 3; i++) {
+        size_t n = strlen(azWord[i]);
+        if (strncmp(p, azWord[i], n) == 0) return p + n;
     }
-
-    case TK_BITNOT: {
-        jw_key_str("type", "unary");
-        jw_key_str("op", "~");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
+    if (*p == '-') p++;
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (*p >= '0' && *p <= '9') p++;
+    } else {
+        return NULL;
     }
-
-    case TK_NOT: {
-        jw_key_str("type", "unary");
-        jw_key_str("op", "NOT");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
+    if (*p == '.') {
+        if (*++p < '0' || *p > '9') return NULL;
+        while (*p >= '0' && *p <= '9') p++;
     }
-
-    case TK_ISNULL: {
-        jw_key_str("type", "isnull");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (*p < '0' || *p > '9') return NULL;
+        while (*p >= '0' && *p <= '9') p++;
     }
+    return p;
+}
 
-    case TK_NOTNULL: {
-        jw_key_str("type", "notnull");
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
-    }
+/* Skip an object member's key and its colon, returning a pointer past them */
+static const char *js_skip_key(const char *p) {
+    p = js_string(js_ws(p), NULL, NULL);
+    if (p == NULL) return NULL;
+    p = js_ws(p);
+    return *p == ':' ? p + 1 : NULL;
+}
 
-    case TK_TRUTH: {
-        /* IS TRUE, IS FALSE, IS NOT TRUE, IS NOT FALSE */
-        int isNot = (pExpr->op2 == TK_ISNOT);
-        int isTrue = sqlite3ExprTruthValue(pExpr->pRight);
-        const char *ops[] = {
-            "IS FALSE", "IS TRUE", "IS NOT FALSE", "IS NOT TRUE"
-        };
-        jw_key_str("type", "truth_test");
-        jw_key_str("op", ops[isNot * 2 + isTrue]);
-        jw_key("operand");
-        json_expr(pExpr->pLeft);
-        break;
-    }
+/* Containers nested deeper than this are rejected */
+#define JS_MAX_DEPTH 256
 
-    case TK_RAISE: {
-        jw_key_str("type", "raise");
-        const char *zType = "unknown";
-        switch (pExpr->affExpr) {
-            case OE_Rollback: zType = "ROLLBACK"; break;
-            case OE_Abort:    zType = "ABORT";    break;
-            case OE_Fail:     zType = "FAIL";     break;
-            case OE_Ignore:   zType = "IGNORE";   break;
+/*
+** Skip over one JSON value, returning a pointer just past it, or NULL if
+** it is not well-formed. The "id" is echoed into the output verbatim, so
+** nothing less than valid JSON can be accepted.
+*/
+static const char *js_skip_value(const char *p) {
+    char aClose[JS_MAX_DEPTH];  /* closing bracket of each open container */
+    int depth = 0;
+    for (;;) {
+        /* A value starts at p */
+        p = js_ws(p);
+        if (*p == '{' || *p == '[') {
+            if (depth == JS_MAX_DEPTH) return NULL;
+            aClose[depth++] = *p == '{' ? '}' : ']';
+            p = js_ws(p + 1);
+            if (*p != aClose[depth - 1]) {
+                if (aClose[depth - 1] == '}' && (p = js_skip_key(p)) == NULL) {
+                    return NULL;
+                }
+                continue;
+            }
+            p++;
+            depth--;
+        } else if (*p == '"') {
+            p = js_string(p, NULL, NULL);
+        } else {
+            p = js_skip_literal(p);
         }
-        jw_key_str("action", zType);
-        if (pExpr->u.zToken) {
-            jw_key_str("message", pExpr->u.zToken);
+        if (p == NULL) return NULL;
+
+        /* Close finished containers, then move on to the next member */
+        for (;;) {
+            if (depth == 0) return p;
+            p = js_ws(p);
+            if (*p == aClose[depth - 1]) {
+                p++;
+                depth--;
+                continue;
+            }
+            if (*p++ != ',') return NULL;
+            if (aClose[depth - 1] == '}' && (p = js_skip_key(p)) == NULL) {
+                return NULL;
+            }
+            break;
         }
-        break;
-    }
-
-    case TK_VECTOR: {
-        jw_key_str("type", "vector");
-        jw_key("values");
-        json_expr_list(pExpr->x.pList);
-        break;
-    }
-
-    case TK_SPAN: {
-        /* SPAN wraps an expression with its original SQL text */
-        jw_key_str("type", "span");
-        jw_key_str("text", pExpr->u.zToken);
-        jw_key("expr");
-        json_expr(pExpr->pLeft);
-        break;
     }
+}
 
-    default: {
-        /* Binary operators */
-        const char *zOp = binop_name(pExpr->op);
-        if (zOp && pExpr->pLeft && pExpr->pRight) {
-            jw_key_str("type", "binary");
-            jw_key_str("op", zOp);
-            jw_key("left");
-            json_expr(pExpr->pLeft);
-            jw_key("right");
-            json_expr(pExpr->pRight);
+/*
+** Parse a request line into *pReq, decoding the SQL into zSqlBuf (which
+** must be at least as large as the line). Returns NULL on success or an
+** error message.
+*/
+static const char *parse_request(const char *zLine, char *zSqlBuf, Request *pReq) {
+    const char *p = js_ws(zLine);
+    int haveSql = 0;
+
+    pReq->zId = "null";
+    pReq->nId = 4;
+    pReq->zSql = NULL;
+    pReq->nSql = 0;
+    if (*p++ != '{') return "request is not a JSON object";
+    p = js_ws(p);
+    if (*p == '}') return "request has no \"sql\" field";
+    for (;;) {
+        const char *zKey = js_ws(p);
+        p = js_string(zKey, NULL, NULL);
+        if (p == NULL) return "malformed JSON in request";
+        int nKey = (int)(p - zKey);
+        p = js_ws(p);
+        if (*p++ != ':') return "malformed JSON in request";
+        p = js_ws(p);
+        if (nKey == 4 && memcmp(zKey, "\"id\"", 4) == 0) {
+            const char *zEnd = js_skip_value(p);
+            if (zEnd == NULL) return "malformed JSON in request";
+            pReq->zId = p;
+            pReq->nId = (int)(zEnd - p);
+            p = zEnd;
+        } else if (nKey == 5 && memcmp(zKey, "\"sql\"", 5) == 0) {
+            if (*p != '"') return "\"sql\" must be a string";
+            p = js_string(p, zSqlBuf, &pReq->nSql);
+            if (p == NULL) return "malformed JSON string in \"sql\"";
+            zSqlBuf[pReq->nSql] = 0;
+            pReq->zSql = zSqlBuf;
+            haveSql = 1;
         } else {
-            /* Fallback: output the opcode number */
-            jw_key_str("type", "unknown");
-            jw_key("op");
-            jw_int(pExpr->op);
+            p = js_skip_value(p);
+            if (p == NULL) return "malformed JSON in request";
         }
-        break;
+        p = js_ws(p);
+        if (*p == ',') { p++; continue; }
+        if (*p == '}') break;
+        return "malformed JSON in request";
     }
-
-    } /* end switch */
-
-    jw_obj_end();
+    if (*js_ws(p + 1) != 0) return "trailing data after request object";
+    if (!haveSql) return "request has no \"sql\" field";
+    return NULL;
 }
 
-/* ================================================================
- * AST Serialization - Expression Lists
- * ================================================================ */
+/*
+** Start a record: "{" followed by the "id" member (unless zId is NULL,
+** for the statements of a single --split query) and, with --split, the
+** "offset" of the statement in the request's SQL.
+*/
+static void print_record_head(const Request *pReq, long long iOff) {
+    putchar('{');
+    if (pReq->zId) printf("\"id\":%.*s,", pReq->nId, pReq->zId);
+    if (iOff >= 0) printf("\"offset\":%lld,", iOff);
+}
 
-static void json_expr_list(const ExprList *pList) {
-    if (pList == NULL) {
-        jw_null();
-        return;
-    }
-    jw_arr_start();
-    for (int i = 0; i < pList->nExpr; i++) {
-        json_expr(pList->a[i].pExpr);
+/* Write the subtree table of the last parse as a JSON array to out */
+static void print_subtrees(sqlite_ast *h, FILE *out) {
+    const sqlite_ast_subtree *aSub;
+    int nSub = sqlite_ast_subtrees(h, &aSub);
+    fputc('[', out);
+    for (int i = 0; i < nSub; i++) {
+        fprintf(out, "%s[\"%016llx\",\"%s\",%d]", i ? "," : "",
+                aSub[i].hash, aSub[i].zType, aSub[i].nNode);
     }
-    jw_arr_end();
+    fputc(']', out);
 }
 
-/* ================================================================
- * AST Serialization - Result Columns
- * (Like ExprList but includes alias info)
- * ================================================================ */
-
-static void json_result_columns(const ExprList *pList) {
-    if (pList == NULL) {
-        jw_null();
-        return;
-    }
-    jw_arr_start();
-    for (int i = 0; i < pList->nExpr; i++) {
-        jw_obj_start();
-        jw_key("expr");
-        json_expr(pList->a[i].pExpr);
-        /* Alias: only output if this is an explicit AS name */
-        if (pList->a[i].zEName && pList->a[i].fg.eEName == ENAME_NAME) {
-            jw_key_str("alias", pList->a[i].zEName);
-        } else {
-            jw_key_null("alias");
-        }
-        jw_obj_end();
+/*
+** Add the "stats" and "subtrees" members to a record, if statistics or
+** subtree hashes are being kept. ok is false if the request failed.
+*/
+static void print_record_stats(sqlite_ast *h, int subtrees, int ok) {
+    const char *zStats = sqlite_ast_stats(h);
+    if (zStats[0]) printf(",\"stats\":%s", zStats);
+    if (subtrees && ok) {
+        fputs(",\"subtrees\":", stdout);
+        print_subtrees(h, stdout);
     }
-    jw_arr_end();
 }
 
 /* ================================================================
- * AST Serialization - ORDER BY Columns
- * (Like ExprList but includes direction)
+ * CBOR Batch Records
+ *
+ * With --format=cbor each record is a CBOR map with the same members as
+ * the JSON one, written back to back as a CBOR sequence (RFC 8742). A
+ * string, integer, boolean or null id keeps its type; any other id is
+ * passed on as its JSON text. "stats" is the JSON text of the statistics.
  * ================================================================ */
 
-static void json_order_by(const ExprList *pList) {
-    if (pList == NULL) {
-        jw_null();
-        return;
-    }
-    jw_arr_start();
-    for (int i = 0; i < pList->nExpr; i++) {
-        jw_obj_start();
-        jw_key("expr");
-        json_expr(pList->a[i].pExpr);
-        if (pList->a[i].fg.sortFlags & KEYINFO_ORDER_DESC) {
-            jw_key_str("direction", "DESC");
+static void cbor_head(int major, unsigned long long v) {
+    int n = v < 24 ? 0 : v <= 0xff ? 1 : v <= 0xffff ? 2 : v <= 0xffffffff ? 4 : 8;
+    putchar((major << 5) | (n == 0 ? (int)v : n == 1 ? 24 : n == 2 ? 25 : n == 4 ? 26 : 27));
+    while (n-- > 0) putchar((int)(v >> (8 * n)) & 0xff);
+}
+
+static void cbor_text(const char *z, size_t n) {
+    cbor_head(3, n);
+    fwrite(z, 1, n, stdout);
+}
+
+static void cbor_id(const Request *pReq) {
+    const char *z = pReq->zId;
+    int n = pReq->nId;
+    int i = z[0] == '-';
+    while (i < n && z[i] >= '0' && z[i] <= '9') i++;
+
+    if (n == 4 && memcmp(z, "null", 4) == 0) {
+        putchar(0xf6);
+    } else if (n == 4 && memcmp(z, "true", 4) == 0) {
+        putchar(0xf5);
+    } else if (n == 5 && memcmp(z, "false", 5) == 0) {
+        putchar(0xf4);
+    } else if (i == n && n > (z[0] == '-') && n < 19) {
+        long long v = strtoll(z, NULL, 10);
+        if (v >= 0) cbor_head(0, (unsigned long long)v);
+        else cbor_head(1, (unsigned long long)(-1 - v));
+    } else if (z[0] == '"') {
+        char *zText = malloc((size_t)n);
+        int nText = 0;
+        if (zText && js_string(z, zText, &nText)) {
+            cbor_text(zText, (size_t)nText);
         } else {
-            jw_key_str("direction", "ASC");
+            cbor_text(z, (size_t)n);
         }
-        if (pList->a[i].fg.bNulls) {
-            if (pList->a[i].fg.sortFlags & KEYINFO_ORDER_BIGNULL) {
-                jw_key_str("nulls", "LAST");
-            } else {
-                jw_key_str("nulls", "FIRST");
-            }
-        }
-        jw_obj_end();
+        free(zText);
+    } else {
+        cbor_text(z, (size_t)n);
     }
-    jw_arr_end();
 }
 
-/* ================================================================
- * AST Serialization - Id List (for USING clauses)
- * ================================================================ */
-
-static void json_id_list(const IdList *pList) {
-    if (pList == NULL) {
-        jw_null();
-        return;
-    }
-    jw_arr_start();
-    for (int i = 0; i < pList->nId; i++) {
-        jw_str(pList->a[i].zName);
-    }
-    jw_arr_end();
+static void cbor_key(const char *zKey) {
+    cbor_text(zKey, strlen(zKey));
 }
 
-/* ================================================================
- * AST Serialization - FROM Clause (SrcList)
- * ================================================================ */
-
-static const char *join_type_name(u8 jt) {
-    if (jt == 0) return NULL; /* no explicit join, just comma-separated */
-
-    /* Check for FULL OUTER JOIN first */
-    if ((jt & (JT_LEFT | JT_RIGHT)) == (JT_LEFT | JT_RIGHT)) {
-        if (jt & JT_NATURAL) return "NATURAL FULL OUTER JOIN";
-        return "FULL OUTER JOIN";
+/* Write a record holding either the AST (zAst, nAst bytes) or zErr */
+static void cbor_record(const Request *pReq, long long iOff, const char *zAst,
+                        size_t nAst, const char *zErr, const char *zStats) {
+    cbor_head(5, 1 + (pReq->zId != NULL) + (iOff >= 0) + (zStats[0] != 0));
+    if (pReq->zId) {
+        cbor_key("id");
+        cbor_id(pReq);
     }
-    if (jt & JT_LEFT) {
-        if (jt & JT_NATURAL) return "NATURAL LEFT JOIN";
-        return "LEFT JOIN";
+    if (iOff >= 0) {
+        cbor_key("offset");
+        cbor_head(0, (unsigned long long)iOff);
     }
-    if (jt & JT_RIGHT) {
-        if (jt & JT_NATURAL) return "NATURAL RIGHT JOIN";
-        return "RIGHT JOIN";
-    }
-    if (jt & JT_CROSS) {
-        return "CROSS JOIN";
-    }
-    if (jt & JT_NATURAL) {
-        return "NATURAL JOIN";
+    if (zErr == NULL) {
+        cbor_key("ast");
+        fwrite(zAst, 1, nAst, stdout);
+    } else {
+        cbor_key("error");
+        cbor_text(zErr, strlen(zErr));
     }
-    if (jt & JT_INNER) {
-        return "JOIN";
+    if (zStats[0]) {
+        cbor_key("stats");
+        cbor_text(zStats, strlen(zStats));
     }
-    return NULL;
 }
 
-static void json_src_list(const SrcList *pSrc) {
-    if (pSrc == NULL || pSrc->nSrc == 0) {
-        jw_null();
-        return;
-    }
-    jw_arr_start();
-    for (int i = 0; i < pSrc->nSrc; i++) {
-        const SrcItem *pItem = &pSrc->a[i];
-        jw_obj_start();
-
-        if (pItem->fg.isSubquery) {
-            jw_key_str("type", "subquery");
-            jw_key("select");
-            json_select(pItem->u4.pSubq->pSelect);
-        } else {
-            jw_key_str("type", "table");
-            jw_key_str("name", pItem->zName);
-            if (pItem->u4.zDatabase && !pItem->fg.fixedSchema) {
-                jw_key_str("schema", pItem->u4.zDatabase);
-            }
-        }
-
-        jw_key_str("alias", pItem->zAlias);
-
-        /* Join type */
-        const char *joinName = join_type_name(pItem->fg.jointype);
-        jw_key_str("join_type", joinName);
+/* Write the "fingerprint" and "shape" members of a fingerprint record */
+static void print_fingerprint(unsigned long long iHash, const char *zShape) {
+    printf("\"fingerprint\":\"%016llx\",\"shape\":", iHash);
+    print_json_string(zShape);
+}
 
-        /* ON clause */
-        if (pItem->fg.isOn || pItem->u3.pOn) {
-            jw_key("on");
-            json_expr(pItem->u3.pOn);
-        }
+/* What each record holds, from the command line */
+typedef struct OutputMode {
+    int cbor;         /* --format=cbor */
+    int fingerprint;  /* --fingerprint */
+    int subtrees;     /* --subtrees */
+    int split;        /* --split: one record per statement */
+} OutputMode;
 
-        /* USING clause */
-        if (pItem->fg.isUsing && pItem->u3.pUsing) {
-            jw_key("using");
-            json_id_list(pItem->u3.pUsing);
+/*
+** Write the record for one statement (nSql bytes at zSql, or the first
+** statement there if nSql is negative, at offset iOff in the request or
+** -1 without --split), or for a request that could not be decoded
+** (zErr). The AST is parsed into the handle's buffer before the record
+** is started, so a parse that fails partway (out of memory, say) leaves
+** no partial line behind for readers to choke on.
+*/
+static void run_statement(sqlite_ast *h, const OutputMode *pMode,
+                          const Request *pReq, const char *zSql, int nSql,
+                          long long iOff, const char *zErr) {
+    int parsed = zErr == NULL;
+
+    if (pMode->fingerprint) {
+        unsigned long long iHash;
+        const char *zShape;
+        if (parsed && sqlite_ast_fingerprint(h, zSql, nSql, &iHash, &zShape)
+                          != SQLITE_AST_OK) {
+            zErr = sqlite_ast_errmsg(h);
         }
-
-        /* Table-valued function arguments */
-        if (pItem->fg.isTabFunc && pItem->u1.pFuncArg) {
-            jw_key("args");
-            json_expr_list(pItem->u1.pFuncArg);
+        print_record_head(pReq, iOff);
+        if (zErr == NULL) {
+            print_fingerprint(iHash, zShape);
+        } else {
+            fputs("\"error\":", stdout);
+            print_json_string(zErr);
         }
-
-        jw_obj_end();
+        if (parsed) print_record_stats(h, pMode->subtrees, zErr == NULL);
+        fputs("}\n", stdout);
+        return;
     }
-    jw_arr_end();
-}
 
-/* ================================================================
- * AST Serialization - WITH / CTE
- * ================================================================ */
-
-static void json_with(const With *pWith) {
-    if (pWith == NULL) {
-        jw_null();
+    const char *zAst = NULL;
+    size_t nAst = 0;
+    if (parsed && sqlite_ast_parse(h, zSql, nSql, &zAst, &nAst) != SQLITE_AST_OK) {
+        zErr = sqlite_ast_errmsg(h);
+    }
+    if (pMode->cbor) {
+        cbor_record(pReq, iOff, zAst, nAst, zErr, parsed ? sqlite_ast_stats(h) : "");
         return;
     }
-    jw_arr_start();
-    for (int i = 0; i < pWith->nCte; i++) {
-        const Cte *pCte = &pWith->a[i];
-        jw_obj_start();
-        jw_key_str("name", pCte->zName);
-        /* Column list */
-        if (pCte->pCols && pCte->pCols->nExpr > 0) {
-            jw_key("columns");
-            jw_arr_start();
-            for (int j = 0; j < pCte->pCols->nExpr; j++) {
-                jw_str(pCte->pCols->a[j].zEName);
-            }
-            jw_arr_end();
-        }
-        /* Materialization hint */
-        if (pCte->eM10d == M10d_Yes) {
-            jw_key_str("materialized", "MATERIALIZED");
-        } else if (pCte->eM10d == M10d_No) {
-            jw_key_str("materialized", "NOT MATERIALIZED");
-        }
-        /* The CTE body */
-        jw_key("select");
-        json_select(pCte->pSelect);
-        jw_obj_end();
+    print_record_head(pReq, iOff);
+    if (zErr == NULL) {
+        fputs("\"ast\":", stdout);
+        fwrite(zAst, 1, nAst, stdout);
+    } else {
+        fputs("\"error\":", stdout);
+        print_json_string(zErr);
     }
-    jw_arr_end();
+    if (parsed) print_record_stats(h, pMode->subtrees, zErr == NULL);
+    fputs("}\n", stdout);
 }
 
-/* ================================================================
- * AST Serialization - Window Definitions
- * ================================================================ */
-
-#ifndef SQLITE_OMIT_WINDOWFUNC
-static const char *frame_bound_name(u8 bound) {
-    switch (bound) {
-        case TK_UNBOUNDED: return "UNBOUNDED";
-        case TK_CURRENT:   return "CURRENT ROW";
-        case TK_PRECEDING: return "PRECEDING";
-        case TK_FOLLOWING: return "FOLLOWING";
-        default: return "unknown";
+/*
+** Write a record for each statement sqlite_ast_split() finds in the nSql
+** bytes at zSql (none if they hold only blank space and comments), which
+** must be followed by a NUL. With --input, pIn is the file, whose pages
+** are released once its statements have been parsed.
+*/
+static void run_split(sqlite_ast *h, const OutputMode *pMode,
+                      const Request *pReq, const char *zSql, size_t nSql,
+                      InputText *pIn) {
+    size_t iNext = 0;
+    while (iNext < nSql) {
+        size_t iStart;
+        size_t iEnd = iNext + sqlite_ast_split(zSql + iNext, nSql - iNext, &iStart);
+        iStart += iNext;
+        if (iStart == nSql) break;
+        /* Unbounded, so SQLite reads it in place and stops at its end */
+        run_statement(h, pMode, pReq, zSql + iStart, -1, (long long)iStart, NULL);
+        if (pIn) input_release(pIn, iEnd);
+        iNext = iEnd;
     }
 }
 
-static void json_window(const Window *pWin) {
-    if (pWin == NULL) {
-        jw_null();
+/*
+** Write the records for a request: one for its SQL, or with --split one
+** for each statement in it. zErr is set if it could not be decoded.
+*/
+static void run_request(sqlite_ast *h, const OutputMode *pMode,
+                        const Request *pReq, const char *zErr) {
+    if (zErr != NULL || !pMode->split) {
+        run_statement(h, pMode, pReq, pReq->zSql, pReq->nSql, -1, zErr);
         return;
     }
-    jw_obj_start();
-    jw_key_str("name", pWin->zName);
-    jw_key_str("base", pWin->zBase);
-
-    if (pWin->pPartition) {
-        jw_key("partition_by");
-        json_expr_list(pWin->pPartition);
-    }
-
-    if (pWin->pOrderBy) {
-        jw_key("order_by");
-        json_order_by(pWin->pOrderBy);
-    }
+    run_split(h, pMode, pReq, pReq->zSql, (size_t)pReq->nSql, NULL);
+}
 
-    if (pWin->eFrmType != 0 && pWin->eFrmType != TK_FILTER) {
-        jw_key("frame");
-        jw_obj_start();
-        const char *zFrmType = "ROWS";
-        if (pWin->eFrmType == TK_RANGE) zFrmType = "RANGE";
-        if (pWin->eFrmType == TK_GROUPS) zFrmType = "GROUPS";
-        jw_key_str("type", zFrmType);
+static int run_batch(sqlite_ast *h, const OutputMode *pMode) {
+    LineReader reader = {0};
+    char *zSqlBuf = NULL;
+    size_t nSqlBuf = 0;
+    char *zLine;
+    size_t nLine;
 
-        jw_key("start");
-        jw_obj_start();
-        jw_key_str("type", frame_bound_name(pWin->eStart));
-        if (pWin->pStart) {
-            jw_key("expr");
-            json_expr(pWin->pStart);
-        }
-        jw_obj_end();
+    while ((zLine = lr_next(&reader, &nLine)) != NULL) {
+        Request req;
 
-        jw_key("end");
-        jw_obj_start();
-        jw_key_str("type", frame_bound_name(pWin->eEnd));
-        if (pWin->pEnd) {
-            jw_key("expr");
-            json_expr(pWin->pEnd);
-        }
-        jw_obj_end();
-
-        if (pWin->eExclude) {
-            const char *zExclude = "unknown";
-            switch (pWin->eExclude) {
-                case TK_NO:      zExclude = "NO OTHERS"; break;
-                case TK_CURRENT: zExclude = "CURRENT ROW"; break;
-                case TK_GROUP:   zExclude = "GROUP"; break;
-                case TK_TIES:    zExclude = "TIES"; break;
+        if (*js_ws(zLine) == 0) continue;
+        if (nLine + 1 > nSqlBuf) {
+            nSqlBuf = nLine + 1;
+            zSqlBuf = realloc(zSqlBuf, nSqlBuf);
+            if (zSqlBuf == NULL) {
+                fprintf(stderr, "Out of memory reading input\n");
+                return 1;
             }
-            jw_key_str("exclude", zExclude);
         }
-        jw_obj_end();
-    }
-
-    if (pWin->pFilter) {
-        jw_key("filter");
-        json_expr(pWin->pFilter);
+        run_request(h, pMode, &req, parse_request(zLine, zSqlBuf, &req));
     }
 
-    jw_obj_end();
+    fflush(stdout);
+    free(zSqlBuf);
+    free(reader.buf);
+    return 0;
 }
-#endif /* SQLITE_OMIT_WINDOWFUNC */
 
 /* ================================================================
- * AST Serialization - SELECT Statement
+ * Main Program
  * ================================================================ */
 
-static void json_select(const Select *p) {
-    if (p == NULL) {
-        jw_null();
-        return;
-    }
-
-    /*
-    ** For compound selects (UNION, INTERSECT, EXCEPT), walk the chain.
-    ** The chain via pPrior goes: rightmost → ... → leftmost.
-    ** We want to output in left-to-right order, so first collect them.
-    */
-    if (p->pPrior) {
-        /* Count the chain */
-        int count = 0;
-        const Select *q;
-        for (q = p; q != NULL; q = q->pPrior) count++;
-
-        /* Collect pointers in order */
-        const Select **arr = sqlite3_malloc64(count * sizeof(Select *));
-        if (arr == NULL) { jw_null(); return; }
-        int idx = count;
-        for (q = p; q != NULL; q = q->pPrior) arr[--idx] = q;
+static void usage(void) {
+    fprintf(stderr, "Usage: dump_ast [--compact] [--split] [--format=F] [--fingerprint] [--subtrees] [--stats] 'SQL'\n");
+    fprintf(stderr, "       dump_ast [--compact] --all [--format=F] [--subtrees] [--stats] 'SQL'\n");
+    fprintf(stderr, "       dump_ast [options] --input FILE\n");
+    fprintf(stderr, "       dump_ast --batch [--split] [--format=F] [--fingerprint] [--subtrees] [--stats] < requests.jsonl\n");
+    fprintf(stderr, "       dump_ast --version\n");
+    fprintf(stderr, "Outputs the parsed AST as JSON to stdout.\n");
+    fprintf(stderr, "  --compact      omit newlines and indentation\n");
+    fprintf(stderr, "  --batch        one compact record per NDJSON request line\n");
+    fprintf(stderr, "  --split        one compact record per statement in the SQL\n");
+    fprintf(stderr, "  --all          an array of records for every statement in the SQL\n");
+    fprintf(stderr, "  --input FILE   read the SQL from FILE (memory-mapped)\n");
+    fprintf(stderr, "  --format=F     json (the default) or cbor\n");
+    fprintf(stderr, "  --fingerprint  a hash and the normalized query instead of the AST\n");
+    fprintf(stderr, "  --subtrees     list the hash of every subtree\n");
+    fprintf(stderr, "  --stats        report timings, node counts and memory use\n");
+}
 
-        jw_obj_start();
-        jw_key_str("type", "compound");
-        jw_key("body");
-        jw_arr_start();
-        for (int i = 0; i < count; i++) {
-            jw_obj_start();
-            if (i > 0) {
-                /* The operator is stored on the right side of the compound */
-                const char *zOp = "UNION";
-                switch (arr[i]->op) {
-                    case TK_ALL:       zOp = "UNION ALL"; break;
-                    case TK_INTERSECT: zOp = "INTERSECT"; break;
-                    case TK_EXCEPT:    zOp = "EXCEPT";    break;
-                }
-                jw_key_str("operator", zOp);
-            }
-            jw_key("select");
-            /* Output this individual select (non-compound parts) */
-            jw_obj_start();
-            jw_key_str("type", "select");
-            jw_key_bool("distinct", (arr[i]->selFlags & SF_Distinct) ? 1 : 0);
-            jw_key_bool("all", (arr[i]->selFlags & SF_All) ? 1 : 0);
-            jw_key("columns");
-            json_result_columns(arr[i]->pEList);
-            jw_key("from");
-            json_src_list(arr[i]->pSrc);
-            jw_key("where");
-            json_expr(arr[i]->pWhere);
-            jw_key("group_by");
-            json_expr_list(arr[i]->pGroupBy);
-            jw_key("having");
-            json_expr(arr[i]->pHaving);
-            /* Note: ORDER BY and LIMIT are on the outermost select only */
-            jw_obj_end();
-            jw_obj_end();
-        }
-        jw_arr_end();
-        /* ORDER BY and LIMIT apply to the whole compound */
-        jw_key("order_by");
-        json_order_by(p->pOrderBy);
-        if (p->pLimit) {
-            jw_key("limit");
-            json_expr(p->pLimit->pLeft);
-            jw_key("offset");
-            if (p->pLimit->pRight) {
-                json_expr(p->pLimit->pRight);
-            } else {
-                jw_null();
+int main(int argc, char **argv) {
+    const char *zSql = NULL;
+    const char *zInput = NULL;
+    InputText in;
+    OutputMode mode = {0};
+    int batch = 0;
+    int version = 0;
+    int flags = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--version") == 0) {
+            version = 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            flags |= SQLITE_AST_COMPACT;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            flags |= SQLITE_AST_STATS;
+        } else if (strcmp(argv[i], "--split") == 0) {
+            mode.split = 1;
+        } else if (strcmp(argv[i], "--all") == 0) {
+            flags |= SQLITE_AST_ALL;
+        } else if (strcmp(argv[i], "--input") == 0) {
+            if (++i == argc || zInput != NULL) {
+                usage();
+                return 1;
             }
+            zInput = argv[i];
+        } else if (strcmp(argv[i], "--fingerprint") == 0) {
+            mode.fingerprint = 1;
+        } else if (strcmp(argv[i], "--subtrees") == 0) {
+            flags |= SQLITE_AST_SUBTREES;
+        } else if (strcmp(argv[i], "--format=json") == 0) {
+            flags &= ~SQLITE_AST_CBOR;
+        } else if (strcmp(argv[i], "--format=cbor") == 0) {
+            flags |= SQLITE_AST_CBOR;
+        } else if (zSql == NULL) {
+            zSql = argv[i];
         } else {
-            jw_key_null("limit");
-        }
-        jw_obj_end();
-        sqlite3_free(arr);
-        return;
-    }
-
-    /* Simple (non-compound) select */
-    jw_obj_start();
-    jw_key_str("type", "select");
-    jw_key_bool("distinct", (p->selFlags & SF_Distinct) ? 1 : 0);
-    jw_key_bool("all", (p->selFlags & SF_All) ? 1 : 0);
-
-    /* WITH clause */
-    if (p->pWith) {
-        jw_key("with");
-        json_with(p->pWith);
-    }
-
-    /* Result columns */
-    jw_key("columns");
-    json_result_columns(p->pEList);
-
-    /* FROM clause */
-    jw_key("from");
-    json_src_list(p->pSrc);
-
-    /* WHERE clause */
-    jw_key("where");
-    json_expr(p->pWhere);
-
-    /* GROUP BY */
-    jw_key("group_by");
-    json_expr_list(p->pGroupBy);
-
-    /* HAVING */
-    jw_key("having");
-    json_expr(p->pHaving);
-
-#ifndef SQLITE_OMIT_WINDOWFUNC
-    /* Named window definitions (WINDOW w AS (...)) */
-    if (p->pWinDefn) {
-        jw_key("window_definitions");
-        jw_arr_start();
-        for (const Window *pW = p->pWinDefn; pW; pW = pW->pNextWin) {
-            json_window(pW);
+            usage();
+            return 1;
         }
-        jw_arr_end();
     }
-#endif
-
-    /* ORDER BY */
-    jw_key("order_by");
-    json_order_by(p->pOrderBy);
-
-    /* LIMIT / OFFSET */
-    if (p->pLimit) {
-        jw_key("limit");
-        json_expr(p->pLimit->pLeft);
-        jw_key("offset");
-        if (p->pLimit->pRight) {
-            json_expr(p->pLimit->pRight);
-        } else {
-            jw_null();
+    if (version) {
+        if (argc != 2) {
+            usage();
+            return 1;
         }
-    } else {
-        jw_key_null("limit");
-    }
-
-    jw_obj_end();
-}
-
-/* ================================================================
- * Hook Function - Called from patched grammar action
- * ================================================================ */
-
-/* Flags to control AST capture */
-static int g_capture_enabled = 0;
-static int g_captured = 0;
-
-void ast_capture_hook(void *select_ptr) {
-    if (!g_capture_enabled) return;
-    if (g_captured) return;  /* Only capture the first SELECT (the user's query) */
-    g_captured = 1;
-    Select *p = (Select *)select_ptr;
-    jw_init();
-    json_select(p);
-}
-
-/* ================================================================
- * Main Program
- * ================================================================ */
-
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: dump_ast 'SQL query'\n");
-        fprintf(stderr, "Outputs the parsed AST as JSON to stdout.\n");
+        printf("{\"serializer_version\":%d,\"sqlite_source_id\":",
+               SQLITE_AST_SERIALIZER_VERSION);
+        print_json_string(sqlite_ast_sourceid());
+        printf("}\n");
+        return 0;
+    }
+    if ((batch ? zSql != NULL || zInput != NULL : (zSql == NULL) == (zInput == NULL))
+        || ((mode.fingerprint || (flags & SQLITE_AST_SUBTREES))
+            && (flags & SQLITE_AST_CBOR))
+        || ((flags & SQLITE_AST_ALL)
+            && (batch || mode.split || mode.fingerprint))) {
+        usage();
         return 1;
     }
+    if (batch || mode.split) flags |= SQLITE_AST_COMPACT;
+    mode.cbor = (flags & SQLITE_AST_CBOR) != 0;
+    mode.subtrees = (flags & SQLITE_AST_SUBTREES) != 0;
 
-    const char *sql = argv[1];
-    sqlite3 *db;
-    sqlite3_stmt *stmt;
+    sqlite_ast *h;
     int rc;
 
-    rc = sqlite3_open(":memory:", &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to open database: %s\n", sqlite3_errmsg(db));
+    /* No handle is open yet, so the process-wide counters can go on */
+    if (flags & SQLITE_AST_STATS) sqlite_ast_enable_memstatus();
+    rc = sqlite_ast_open(flags, &h);
+    if (rc != SQLITE_AST_OK) {
+        fprintf(stderr, "Failed to open parser\n");
         return 1;
     }
 
-    /* Enable AST capture */
-    g_capture_enabled = 1;
-    g_captured = 0;
-    jw_init();
-
-    /*
-    ** Call prepare to trigger the parser. The patched grammar action will
-    ** call ast_capture_hook() with the raw Select* before any resolution.
-    ** We don't care if prepare fails (e.g., tables don't exist) - we only
-    ** care about the parse tree.
-    */
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-
-    if (g_pos == 0) {
-        /* No AST was captured - probably a parse error */
-        if (rc != SQLITE_OK) {
-            fprintf(stderr, "Parse error: %s\n", sqlite3_errmsg(db));
-        } else {
-            fprintf(stderr, "No SELECT statement found in input\n");
+    if (batch) {
+        rc = run_batch(h, &mode);
+        sqlite_ast_close(h);
+        return rc;
+    }
+    if (zInput) {
+        if (input_open(zInput, &in)) {
+            sqlite_ast_close(h);
+            return 1;
         }
-        sqlite3_close(db);
-        return 1;
+        /*
+        ** A mapping ends in a NUL, so below it is passed with length -1,
+        ** which SQLite parses where it lies rather than copying it.
+        */
+        zSql = in.z;
+    } else {
+        in.z = (char *)zSql;
+        in.n = strlen(zSql);
+    }
+    if (mode.split) {
+        /* The statements become records like those of a batch, without ids */
+        Request req = { NULL, 0, in.z, 0 };
+        run_split(h, &mode, &req, in.z, in.n, zInput ? &in : NULL);
+        fflush(stdout);
+        if (zInput) input_close(&in);
+        sqlite_ast_close(h);
+        return 0;
+    }
+
+    if (mode.fingerprint) {
+        unsigned long long iHash;
+        const char *zShape;
+        rc = sqlite_ast_fingerprint(h, zSql, -1, &iHash, &zShape);
+        if (rc == SQLITE_AST_OK) {
+            putchar('{');
+            print_fingerprint(iHash, zShape);
+            fputs("}\n", stdout);
+        }
+    } else {
+        /* Stream the output to stdout as it is produced */
+        rc = sqlite_ast_parse_stream(h, zSql, -1, write_file, stdout);
     }
+    if (rc != SQLITE_AST_OK) {
+        fflush(stdout);
+        fprintf(stderr, "%s\n", sqlite_ast_errmsg(h));
+    } else {
+        /* CBOR is binary, so it gets no trailing newline */
+        if (!mode.fingerprint && !(flags & SQLITE_AST_CBOR)) putchar('\n');
+        fflush(stdout);
+    }
+    if (rc == SQLITE_AST_OK && (flags & SQLITE_AST_SUBTREES)) {
+        print_subtrees(h, stderr);
+        fputc('\n', stderr);
+    }
+    if (flags & SQLITE_AST_STATS) fprintf(stderr, "%s\n", sqlite_ast_stats(h));
 
-    /* Output the JSON */
-    printf("%s\n", g_buf);
-
-    if (stmt) sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return 0;
+    if (zInput) input_close(&in);
+    sqlite_ast_close(h);
+    return rc != SQLITE_AST_OK;
 }
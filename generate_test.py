@@ -3,20 +3,58 @@
 Generate a JSON test file for a given SQL query using dump_ast.
 
 Usage: python generate_test.py <filename> <sql>
-  Creates ast-tests/<filename>.json with {"sql": ..., "ast": ...}
+  Creates sqlite_ast_conformance/ast-tests/<filename>.json with
+  {"sql": ..., "ast": ...}
 
 Or:     python generate_test.py --batch
   Reads (filename, sql) pairs from stdin, one JSON object per line:
   {"name": "select_literal", "sql": "SELECT 1"}
+  All of them are parsed by a single dump_ast --batch process, skipping
+  any whose AST is already in the cache in build/ (see ast_cache.py).
+
+Or:     python generate_test.py --bundle
+  Only rebuilds sqlite_ast_conformance/ast-tests.ndjson from the test files.
+
+Files are replaced atomically, and only when their content changes. The
+bundle of all test cases is rebuilt after any fixture is written.
 """
 
 import json
+import os
 import subprocess
 import sys
+import tempfile
+import time
 from pathlib import Path
 
+from ast_cache import AstCache
+from sqlite_ast_conformance.bundle import AST_BUNDLE, write_bundle
+
 DUMP_AST = Path(__file__).parent / "build" / "dump_ast"
-AST_TESTS_DIR = Path(__file__).parent / "ast-tests"
+AST_TESTS_DIR = Path(__file__).parent / "sqlite_ast_conformance" / "ast-tests"
+
+
+def write_fixture(name: str, sql: str, ast) -> str:
+    """Write one test file. Returns "created", "updated" or "unchanged"."""
+    out = AST_TESTS_DIR / f"{name}.json"
+    text = json.dumps({"sql": sql, "ast": ast}, indent=2) + "\n"
+    try:
+        if out.read_text() == text:
+            return "unchanged"
+        status = "updated"
+    except FileNotFoundError:
+        status = "created"
+
+    fd, tmp = tempfile.mkstemp(dir=AST_TESTS_DIR, prefix=f".{name}.", suffix=".tmp")
+    try:
+        with os.fdopen(fd, "w") as f:
+            f.write(text)
+        os.chmod(tmp, 0o644)
+        os.replace(tmp, out)
+    except BaseException:
+        os.unlink(tmp)
+        raise
+    return status
 
 
 def generate_one(name: str, sql: str) -> bool:
@@ -37,30 +75,73 @@ def generate_one(name: str, sql: str) -> bool:
         print(f"FAIL {name}: invalid JSON: {e}", file=sys.stderr)
         return False
 
-    out = AST_TESTS_DIR / f"{name}.json"
-    with open(out, "w") as f:
-        json.dump({"sql": sql, "ast": ast}, f, indent=2)
-        f.write("\n")
-
-    print(f"  OK {name}: {sql}")
+    status = write_fixture(name, sql, ast)
+    print(f"  OK {name} ({status}): {sql}")
     return True
 
 
+def generate_batch(requests) -> bool:
+    """Generate test files for (name, sql) pairs. Returns True if all succeed."""
+    start = time.perf_counter()
+    try:
+        cache = AstCache(dump_ast=DUMP_AST)
+        records = cache.parse_many([sql for _, sql in requests])
+        cache.close()
+    except RuntimeError as e:
+        print(f"FAIL {e}", file=sys.stderr)
+        return False
+
+    counts = {"created": 0, "updated": 0, "unchanged": 0, "failed": 0}
+    for (name, sql), record in zip(requests, records):
+        if "error" in record:
+            print(f"FAIL {name}: {record['error']}", file=sys.stderr)
+            counts["failed"] += 1
+            continue
+        status = write_fixture(name, sql, record["ast"])
+        counts[status] += 1
+        if status != "unchanged":
+            print(f"  OK {name} ({status}): {sql}")
+
+    elapsed = time.perf_counter() - start
+    print(
+        f"{len(requests)} queries in {elapsed:.2f}s "
+        f"({len(requests) / max(elapsed, 1e-9):.0f}/s): "
+        + ", ".join(f"{n} {status}" for status, n in counts.items()),
+        file=sys.stderr,
+    )
+    return counts["failed"] == 0
+
+
+def update_bundle():
+    if write_bundle(AST_TESTS_DIR):
+        print(f"Updated {AST_BUNDLE.name}")
+
+
 def main():
     if len(sys.argv) == 3 and sys.argv[1] != "--batch":
         name, sql = sys.argv[1], sys.argv[2]
-        if not generate_one(name, sql):
+        ok = generate_one(name, sql)
+        update_bundle()
+        if not ok:
             sys.exit(1)
+    elif sys.argv[1:] == ["--bundle"]:
+        update_bundle()
     elif "--batch" in sys.argv:
+        requests = []
         for line in sys.stdin:
             line = line.strip()
             if not line:
                 continue
             obj = json.loads(line)
-            generate_one(obj["name"], obj["sql"])
+            requests.append((obj["name"], obj["sql"]))
+        ok = generate_batch(requests)
+        update_bundle()
+        if not ok:
+            sys.exit(1)
     else:
         print("Usage: generate_test.py <name> <sql>", file=sys.stderr)
         print("       generate_test.py --batch < input.jsonl", file=sys.stderr)
+        print("       generate_test.py --bundle", file=sys.stderr)
         sys.exit(1)
 
 
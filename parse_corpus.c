@@ -0,0 +1,726 @@
+/*
+** parse_corpus.c - parse directories of SQL logs into AST NDJSON
+**
+** Splits every input file into statements and parses them on a pool of
+** worker threads, each with its own libsqlite_ast handle. Files are
+** memory-mapped and split with sqlite_ast_split(), and the workers parse
+** each statement in place, so the text is never copied. One compact
+** JSON record per statement is written to stdout, in input order:
+**
+**   {"file":"logs/a.sql","offset":1234,"ast":{...}}
+**   {"file":"logs/a.sql","offset":1290,"error":"..."}
+**
+** where offset is the byte offset of the statement in its file.
+**
+** Usage: parse_corpus [-j THREADS] PATH...
+**   Directories are searched recursively for *.sql files, in name order.
+**   Throughput is reported on stderr at the end.
+**
+**        parse_corpus --subtrees [--min-count N] ...
+**   Instead of the ASTs, counts how often each distinct subtree (see
+**   sqlite_ast_subtrees()) occurs across the whole corpus and writes one
+**   record per subtree of two or more nodes seen at least N times
+**   (default 2), most frequent first:
+**
+**   {"hash":"...","type":"select","nodes":12,"count":310,
+**    "first":{"file":"logs/a.sql","offset":1234}}
+**
+**   where first is the earliest statement containing it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sqlite_ast.h"
+
+/* A batch is cut when it reaches either limit */
+#define BATCH_STMTS 256
+#define BATCH_BYTES (1024 * 1024)
+
+/* Number of independently locked parts of the subtree table */
+#define SUB_SHARDS 64
+
+/* ================================================================
+ * Growable byte buffer
+ * ================================================================ */
+
+typedef struct Buf {
+    char *z;
+    size_t n;
+    size_t cap;
+} Buf;
+
+static void buf_append(Buf *b, const char *z, size_t n) {
+    if (b->n + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->n + n) cap *= 2;
+        char *p = realloc(b->z, cap);
+        if (p == NULL) {
+            fprintf(stderr, "parse_corpus: out of memory\n");
+            exit(1);
+        }
+        b->z = p;
+        b->cap = cap;
+    }
+    memcpy(b->z + b->n, z, n);
+    b->n += n;
+}
+
+#define BUF_LIT(b, s) buf_append(b, "" s, sizeof(s) - 1)
+
+/* Append s as a quoted JSON string */
+static void buf_json_string(Buf *b, const char *s) {
+    BUF_LIT(b, "\"");
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        char esc[8];
+        if (*p == '"' || *p == '\\') {
+            esc[0] = '\\';
+            esc[1] = (char)*p;
+            buf_append(b, esc, 2);
+        } else if (*p < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", *p);
+            buf_append(b, esc, 6);
+        } else {
+            buf_append(b, (const char *)p, 1);
+        }
+    }
+    BUF_LIT(b, "\"");
+}
+
+/* ================================================================
+ * Batches and the pipeline between reader, workers and writer
+ *
+ * The reader thread cuts statements into numbered batches and puts them
+ * on the work queue. Workers take batches from the queue, parse them and
+ * put the output on the done list, which the writer (the main thread)
+ * drains in batch order. At most four batches per worker exist at once, so
+ * memory stays flat however large the input is.
+ * ================================================================ */
+
+/*
+** The contents of an input file, followed by a NUL byte. It is released
+** once the reader and every batch of its statements are done with it.
+*/
+typedef struct InputFile {
+    char *z;
+    size_t n;
+    size_t nMap;           /* bytes mapped at z, or 0 if z was malloc()ed */
+    int nRef;              /* references, protected by g_pipe.mutex */
+} InputFile;
+
+typedef struct Batch Batch;
+struct Batch {
+    long seq;              /* position in the output */
+    const char *zFileJson; /* "file":"..." prefix for its records */
+    InputFile *pFile;      /* the file its statements are in */
+    int nStmt;
+    size_t nBytes;         /* total size of the statements */
+    long long aOffset[BATCH_STMTS]; /* offset of each statement in the file */
+    Buf out;               /* NDJSON records */
+    long nError;
+    Batch *pNext;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cvWork;   /* work queue is non-empty, or input ended */
+    pthread_cond_t cvDone;   /* a batch was finished */
+    pthread_cond_t cvSpace;  /* a batch was written */
+    Batch *pWorkHead;
+    Batch *pWorkTail;
+    Batch *pDone;            /* finished batches, in seq order */
+    long nProduced;          /* batches created by the reader */
+    long nWritten;           /* batches written to stdout */
+    int inputDone;           /* the reader has produced its last batch */
+    int maxInFlight;
+} g_pipe = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+
+static void input_release(InputFile *pFile) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    int nRef = --pFile->nRef;
+    pthread_mutex_unlock(&g_pipe.mutex);
+    if (nRef > 0) return;
+    if (pFile->nMap) munmap(pFile->z, pFile->nMap); else free(pFile->z);
+    free(pFile);
+}
+
+static void batch_free(Batch *b) {
+    free(b->out.z);
+    free(b);
+}
+
+/* Queue a full batch for the workers (reader thread) */
+static void pipe_submit(Batch *b) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    while (g_pipe.nProduced - g_pipe.nWritten >= g_pipe.maxInFlight) {
+        pthread_cond_wait(&g_pipe.cvSpace, &g_pipe.mutex);
+    }
+    b->seq = g_pipe.nProduced++;
+    if (g_pipe.pWorkTail) g_pipe.pWorkTail->pNext = b; else g_pipe.pWorkHead = b;
+    g_pipe.pWorkTail = b;
+    pthread_cond_signal(&g_pipe.cvWork);
+    pthread_mutex_unlock(&g_pipe.mutex);
+}
+
+static void pipe_input_done(void) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    g_pipe.inputDone = 1;
+    pthread_cond_broadcast(&g_pipe.cvWork);
+    pthread_cond_broadcast(&g_pipe.cvDone);
+    pthread_mutex_unlock(&g_pipe.mutex);
+}
+
+/* Take the next batch to parse, or NULL when there is no more input */
+static Batch *pipe_take(void) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    while (g_pipe.pWorkHead == NULL && !g_pipe.inputDone) {
+        pthread_cond_wait(&g_pipe.cvWork, &g_pipe.mutex);
+    }
+    Batch *b = g_pipe.pWorkHead;
+    if (b) {
+        g_pipe.pWorkHead = b->pNext;
+        if (g_pipe.pWorkHead == NULL) g_pipe.pWorkTail = NULL;
+        b->pNext = NULL;
+    }
+    pthread_mutex_unlock(&g_pipe.mutex);
+    return b;
+}
+
+/* Hand a parsed batch to the writer, keeping the done list in seq order */
+static void pipe_finish(Batch *b) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    Batch **pp = &g_pipe.pDone;
+    while (*pp && (*pp)->seq < b->seq) pp = &(*pp)->pNext;
+    b->pNext = *pp;
+    *pp = b;
+    pthread_cond_broadcast(&g_pipe.cvDone);
+    pthread_mutex_unlock(&g_pipe.mutex);
+}
+
+/* Wait for the next batch in output order, or NULL at the end */
+static Batch *pipe_next_output(void) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    for (;;) {
+        Batch *b = g_pipe.pDone;
+        if (b && b->seq == g_pipe.nWritten) {
+            g_pipe.pDone = b->pNext;
+            pthread_mutex_unlock(&g_pipe.mutex);
+            return b;
+        }
+        if (g_pipe.inputDone && g_pipe.nWritten == g_pipe.nProduced) break;
+        pthread_cond_wait(&g_pipe.cvDone, &g_pipe.mutex);
+    }
+    pthread_mutex_unlock(&g_pipe.mutex);
+    return NULL;
+}
+
+static void pipe_written(void) {
+    pthread_mutex_lock(&g_pipe.mutex);
+    g_pipe.nWritten++;
+    pthread_cond_signal(&g_pipe.cvSpace);
+    pthread_mutex_unlock(&g_pipe.mutex);
+}
+
+/* ================================================================
+ * Reader - statement splitting
+ *
+ * Each file is mapped into memory whole and cut into statements with
+ * sqlite_ast_split(), which uses SQLite's tokenizer (the same rules as
+ * sqlite3_complete()), so semicolons inside strings, comments and CREATE
+ * TRIGGER bodies do not split a statement. Whatever is left at the end
+ * of a file is a final statement without a semicolon. Batches refer to
+ * the statements where they lie in the mapping.
+ * ================================================================ */
+
+typedef struct Reader {
+    char **azPath;         /* files to read, in output order */
+    int nPath;
+    Batch *pBatch;         /* batch being filled */
+    const char *zFileJson; /* prefix for the current file's records */
+    long long nBytes;      /* input bytes read */
+    long nStmt;            /* statements found */
+} Reader;
+
+/*
+** Map zPath into memory, followed by a NUL byte for the tokenizer. The
+** mapping is placed at the start of a zero-filled anonymous one at least
+** a byte longer, so the byte after the file is 0 even when the file ends
+** on a page boundary. Anything that cannot be mapped, such as a pipe, is
+** read into memory instead.
+*/
+static InputFile *input_open(const char *zPath) {
+    int fd = open(zPath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "parse_corpus: %s: %s\n", zPath, strerror(errno));
+        return NULL;
+    }
+    InputFile *pFile = calloc(1, sizeof(*pFile));
+    if (pFile == NULL) {
+        fprintf(stderr, "parse_corpus: out of memory\n");
+        exit(1);
+    }
+    pFile->nRef = 1;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t nPage = (size_t)sysconf(_SC_PAGESIZE);
+        size_t nMap = ((size_t)st.st_size / nPage + 1) * nPage;
+        char *z = mmap(NULL, nMap, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (z != MAP_FAILED && st.st_size > 0
+            && mmap(z, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+                   == MAP_FAILED) {
+            munmap(z, nMap);
+            z = MAP_FAILED;
+        }
+        if (z != MAP_FAILED) {
+            madvise(z, nMap, MADV_SEQUENTIAL);
+            pFile->z = z;
+            pFile->n = (size_t)st.st_size;
+            pFile->nMap = nMap;
+        }
+    }
+    if (pFile->z == NULL) {
+        Buf text = {0};
+        char aChunk[65536];
+        for (;;) {
+            ssize_t n = read(fd, aChunk, sizeof(aChunk));
+            if (n > 0) {
+                buf_append(&text, aChunk, (size_t)n);
+            } else if (n == 0) {
+                break;
+            } else if (errno != EINTR) {
+                fprintf(stderr, "parse_corpus: %s: %s\n", zPath, strerror(errno));
+                break;
+            }
+        }
+        buf_append(&text, "", 1);
+        pFile->z = text.z;
+        pFile->n = text.n - 1;
+    }
+    close(fd);
+    return pFile;
+}
+
+static void reader_flush(Reader *r) {
+    if (r->pBatch && r->pBatch->nStmt > 0) {
+        pipe_submit(r->pBatch);
+        r->pBatch = NULL;
+    }
+}
+
+/* Add the statement of n bytes at offset iOff in pFile */
+static void reader_add(Reader *r, InputFile *pFile, long long iOff, size_t n) {
+    Batch *b = r->pBatch;
+    if (b && (b->nStmt == BATCH_STMTS || b->nBytes >= BATCH_BYTES
+              || b->pFile != pFile)) {
+        reader_flush(r);
+        b = NULL;
+    }
+    if (b == NULL) {
+        b = calloc(1, sizeof(*b));
+        if (b == NULL) {
+            fprintf(stderr, "parse_corpus: out of memory\n");
+            exit(1);
+        }
+        b->zFileJson = r->zFileJson;
+        b->pFile = pFile;
+        pthread_mutex_lock(&g_pipe.mutex);
+        pFile->nRef++;
+        pthread_mutex_unlock(&g_pipe.mutex);
+        r->pBatch = b;
+    }
+    b->aOffset[b->nStmt] = iOff;
+    b->nStmt++;
+    b->nBytes += n;
+    r->nStmt++;
+}
+
+static void read_file(Reader *r, const char *zPath) {
+    InputFile *pFile = input_open(zPath);
+    if (pFile == NULL) return;
+
+    /* The quoted file name is shared by all its records; kept until exit */
+    Buf name = {0};
+    BUF_LIT(&name, "{\"file\":");
+    buf_json_string(&name, zPath);
+    BUF_LIT(&name, ",\"offset\":");
+    buf_append(&name, "", 1);
+    r->zFileJson = name.z;
+
+    size_t iNext = 0;
+    while (iNext < pFile->n) {
+        size_t iStart;
+        size_t iEnd = iNext + sqlite_ast_split(pFile->z + iNext, pFile->n - iNext, &iStart);
+        iStart += iNext;
+        if (iStart == pFile->n) break;
+        reader_add(r, pFile, (long long)iStart, iEnd - iStart);
+        iNext = iEnd;
+    }
+
+    r->nBytes += (long long)pFile->n;
+    input_release(pFile);
+}
+
+static void *reader_main(void *pArg) {
+    Reader *r = (Reader *)pArg;
+    for (int i = 0; i < r->nPath; i++) read_file(r, r->azPath[i]);
+    reader_flush(r);
+    pipe_input_done();
+    return NULL;
+}
+
+/* ================================================================
+ * Subtree counts (--subtrees)
+ *
+ * Every worker adds the subtrees of each statement it parses to one
+ * table shared by all of them. The table is split into SUB_SHARDS
+ * open-addressing hash tables, each with its own lock and picked by the
+ * top bits of the hash, so workers rarely wait for one another. An entry
+ * remembers the earliest statement it was seen in, numbered in input
+ * order, so the result does not depend on how the work was scheduled.
+ * ================================================================ */
+
+typedef struct SubEntry {
+    unsigned long long hash;
+    const char *zType;
+    int nNode;
+    long count;             /* 0 if the slot is empty */
+    long long iFirst;       /* input position of the first statement */
+    const char *zFileJson;  /* ... its file's record prefix */
+    long long iOffset;      /* ... and its offset in the file */
+} SubEntry;
+
+typedef struct SubShard {
+    pthread_mutex_t mutex;
+    SubEntry *a;            /* nAlloc slots, a power of two */
+    size_t nAlloc;
+    size_t nUsed;
+} SubShard;
+
+static SubShard g_aShard[SUB_SHARDS];
+
+/* The slot for hash in a table of nAlloc slots (linear probing) */
+static SubEntry *sub_slot(SubEntry *a, size_t nAlloc, unsigned long long hash) {
+    size_t i = (size_t)hash & (nAlloc - 1);
+    while (a[i].count && a[i].hash != hash) i = (i + 1) & (nAlloc - 1);
+    return &a[i];
+}
+
+/* Count one occurrence of pSub, seen in statement iStmt of batch b */
+static void sub_add(const sqlite_ast_subtree *pSub, const Batch *b, int iStmt) {
+    SubShard *pShard = &g_aShard[pSub->hash >> 58];
+    long long iFirst = (long long)b->seq * BATCH_STMTS + iStmt;
+
+    pthread_mutex_lock(&pShard->mutex);
+    if ((pShard->nUsed + 1) * 2 > pShard->nAlloc) {
+        size_t nAlloc = pShard->nAlloc ? pShard->nAlloc * 2 : 1024;
+        SubEntry *a = calloc(nAlloc, sizeof(*a));
+        if (a == NULL) {
+            fprintf(stderr, "parse_corpus: out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < pShard->nAlloc; i++) {
+            if (pShard->a[i].count) {
+                *sub_slot(a, nAlloc, pShard->a[i].hash) = pShard->a[i];
+            }
+        }
+        free(pShard->a);
+        pShard->a = a;
+        pShard->nAlloc = nAlloc;
+    }
+    SubEntry *e = sub_slot(pShard->a, pShard->nAlloc, pSub->hash);
+    if (e->count == 0) {
+        e->hash = pSub->hash;
+        e->zType = pSub->zType;
+        e->nNode = pSub->nNode;
+        e->iFirst = iFirst;
+        e->zFileJson = b->zFileJson;
+        e->iOffset = b->aOffset[iStmt];
+        pShard->nUsed++;
+    } else if (iFirst < e->iFirst) {
+        e->iFirst = iFirst;
+        e->zFileJson = b->zFileJson;
+        e->iOffset = b->aOffset[iStmt];
+    }
+    e->count++;
+    pthread_mutex_unlock(&pShard->mutex);
+}
+
+/* Most frequent first, then largest, then by hash */
+static int sub_cmp(const void *pA, const void *pB) {
+    const SubEntry *a = *(const SubEntry *const *)pA;
+    const SubEntry *b = *(const SubEntry *const *)pB;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    if (a->nNode != b->nNode) return a->nNode > b->nNode ? -1 : 1;
+    return a->hash < b->hash ? -1 : a->hash > b->hash;
+}
+
+/* Write the subtrees seen at least minCount times; returns the distinct count */
+static size_t sub_report(long minCount) {
+    size_t nDistinct = 0;
+    size_t n = 0;
+    for (int i = 0; i < SUB_SHARDS; i++) nDistinct += g_aShard[i].nUsed;
+    SubEntry **aSort = malloc((nDistinct ? nDistinct : 1) * sizeof(*aSort));
+    if (aSort == NULL) {
+        fprintf(stderr, "parse_corpus: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < SUB_SHARDS; i++) {
+        SubShard *pShard = &g_aShard[i];
+        for (size_t j = 0; j < pShard->nAlloc; j++) {
+            SubEntry *e = &pShard->a[j];
+            if (e->count >= minCount && e->nNode >= 2) aSort[n++] = e;
+        }
+    }
+    qsort(aSort, n, sizeof(*aSort), sub_cmp);
+    for (size_t i = 0; i < n; i++) {
+        SubEntry *e = aSort[i];
+        printf("{\"hash\":\"%016llx\",\"type\":\"%s\",\"nodes\":%d,"
+               "\"count\":%ld,\"first\":%s%lld}}\n",
+               e->hash, e->zType, e->nNode, e->count, e->zFileJson, e->iOffset);
+    }
+    free(aSort);
+    for (int i = 0; i < SUB_SHARDS; i++) free(g_aShard[i].a);
+    return nDistinct;
+}
+
+/* ================================================================
+ * Workers
+ * ================================================================ */
+
+static int g_subtrees;  /* --subtrees: count subtrees instead of writing ASTs */
+
+static int worker_write(void *pArg, const char *z, size_t n) {
+    buf_append((Buf *)pArg, z, n);
+    return 0;
+}
+
+static void *worker_main(void *pArg) {
+    sqlite_ast *h = NULL;
+    (void)pArg;
+    if (sqlite_ast_open(g_subtrees ? SQLITE_AST_SUBTREES : SQLITE_AST_COMPACT, &h)
+            != SQLITE_AST_OK) {
+        fprintf(stderr, "parse_corpus: failed to open parser\n");
+        exit(1);
+    }
+
+    Batch *b;
+    while ((b = pipe_take()) != NULL) {
+        for (int i = 0; i < b->nStmt; i++) {
+            char zOff[24];
+            /*
+            ** The file is NUL-terminated, so no length is given: SQLite
+            ** copies text whose length is given, but otherwise reads it
+            ** in place and stops at the end of the first statement.
+            */
+            const char *zSql = b->pFile->z + b->aOffset[i];
+
+            if (g_subtrees) {
+                /* A fingerprint walks the tree without writing any JSON */
+                unsigned long long iHash;
+                const sqlite_ast_subtree *aSub;
+                if (sqlite_ast_fingerprint(h, zSql, -1, &iHash, NULL)
+                        != SQLITE_AST_OK) {
+                    b->nError++;
+                    continue;
+                }
+                int nSub = sqlite_ast_subtrees(h, &aSub);
+                for (int j = 0; j < nSub; j++) sub_add(&aSub[j], b, i);
+                continue;
+            }
+
+            buf_append(&b->out, b->zFileJson, strlen(b->zFileJson));
+            buf_append(&b->out, zOff,
+                       (size_t)snprintf(zOff, sizeof(zOff), "%lld", b->aOffset[i]));
+            size_t iMark = b->out.n;
+            BUF_LIT(&b->out, ",\"ast\":");
+            if (sqlite_ast_parse_stream(h, zSql, -1, worker_write, &b->out)
+                    == SQLITE_AST_OK) {
+                BUF_LIT(&b->out, "}\n");
+            } else {
+                b->out.n = iMark;
+                BUF_LIT(&b->out, ",\"error\":");
+                buf_json_string(&b->out, sqlite_ast_errmsg(h));
+                BUF_LIT(&b->out, "}\n");
+                b->nError++;
+            }
+        }
+        input_release(b->pFile);
+        b->pFile = NULL;
+        pipe_finish(b);
+    }
+
+    sqlite_ast_close(h);
+    return NULL;
+}
+
+/* ================================================================
+ * Input discovery
+ * ================================================================ */
+
+typedef struct PathList {
+    char **az;
+    int n;
+    int cap;
+} PathList;
+
+static void path_add(PathList *p, const char *z) {
+    if (p->n == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 64;
+        p->az = realloc(p->az, p->cap * sizeof(char *));
+        if (p->az == NULL) {
+            fprintf(stderr, "parse_corpus: out of memory\n");
+            exit(1);
+        }
+    }
+    p->az[p->n++] = strdup(z);
+}
+
+static int has_sql_suffix(const char *z) {
+    size_t n = strlen(z);
+    return n > 4 && strcmp(z + n - 4, ".sql") == 0;
+}
+
+/* Add zPath, or the *.sql files below it if it is a directory */
+static void collect(PathList *p, const char *zPath, int explicit) {
+    struct stat st;
+    if (stat(zPath, &st) != 0) {
+        fprintf(stderr, "parse_corpus: %s: %s\n", zPath, strerror(errno));
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (explicit || has_sql_suffix(zPath)) path_add(p, zPath);
+        return;
+    }
+    struct dirent **azEntry;
+    int nEntry = scandir(zPath, &azEntry, NULL, alphasort);
+    if (nEntry < 0) {
+        fprintf(stderr, "parse_corpus: %s: %s\n", zPath, strerror(errno));
+        return;
+    }
+    for (int i = 0; i < nEntry; i++) {
+        const char *zName = azEntry[i]->d_name;
+        if (zName[0] != '.') {
+            size_t n = strlen(zPath) + strlen(zName) + 2;
+            char *zChild = malloc(n);
+            snprintf(zChild, n, "%s/%s", zPath, zName);
+            collect(p, zChild, 0);
+            free(zChild);
+        }
+        free(azEntry[i]);
+    }
+    free(azEntry);
+}
+
+/* ================================================================
+ * Main Program
+ * ================================================================ */
+
+static void usage(void) {
+    fprintf(stderr, "Usage: parse_corpus [-j THREADS] [--subtrees [--min-count N]] PATH...\n");
+    fprintf(stderr, "Parses every statement in the given files (and *.sql files\n");
+    fprintf(stderr, "under the given directories) to NDJSON on stdout.\n");
+    fprintf(stderr, "  -j THREADS     worker threads (default: one per CPU)\n");
+    fprintf(stderr, "  --subtrees     count repeated subtrees instead of writing ASTs\n");
+    fprintf(stderr, "  --min-count N  only report subtrees seen N times (default 2)\n");
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int nThread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    PathList paths = {0};
+    int nArg = 0;
+    long minCount = 2;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nThread = atoi(argv[++i]);
+            if (nThread < 1) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--subtrees") == 0) {
+            g_subtrees = 1;
+        } else if (strcmp(argv[i], "--min-count") == 0 && i + 1 < argc) {
+            minCount = atol(argv[++i]);
+            if (minCount < 1) {
+                usage();
+                return 1;
+            }
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        } else {
+            collect(&paths, argv[i], 1);
+            nArg++;
+        }
+    }
+    if (nArg == 0) {
+        usage();
+        return 1;
+    }
+    if (nThread < 1) nThread = 1;
+    g_pipe.maxInFlight = 4 * nThread;
+    for (int i = 0; i < SUB_SHARDS; i++) pthread_mutex_init(&g_aShard[i].mutex, NULL);
+
+    double start = now();
+    Reader reader = {0};
+    reader.azPath = paths.az;
+    reader.nPath = paths.n;
+    pthread_t readerThread;
+    pthread_t *aWorker = malloc(nThread * sizeof(pthread_t));
+    pthread_create(&readerThread, NULL, reader_main, &reader);
+    for (int i = 0; i < nThread; i++) {
+        pthread_create(&aWorker[i], NULL, worker_main, NULL);
+    }
+
+    /* Write batches as they complete, in input order */
+    long nError = 0;
+    Batch *b;
+    while ((b = pipe_next_output()) != NULL) {
+        fwrite(b->out.z, 1, b->out.n, stdout);
+        nError += b->nError;
+        batch_free(b);
+        pipe_written();
+    }
+    fflush(stdout);
+
+    pthread_join(readerThread, NULL);
+    for (int i = 0; i < nThread; i++) pthread_join(aWorker[i], NULL);
+    if (g_subtrees) {
+        size_t nDistinct = sub_report(minCount);
+        fflush(stdout);
+        fprintf(stderr, "parse_corpus: %zu distinct subtrees\n", nDistinct);
+    }
+    double elapsed = now() - start;
+
+    fprintf(stderr,
+            "parse_corpus: %ld statements (%ld errors) from %d files, "
+            "%.1f MB in %.2fs with %d threads: %.0f statements/sec, %.1f MB/sec\n",
+            reader.nStmt, nError, paths.n, reader.nBytes / 1e6, elapsed, nThread,
+            reader.nStmt / elapsed, reader.nBytes / 1e6 / elapsed);
+
+    free(aWorker);
+    for (int i = 0; i < paths.n; i++) free(paths.az[i]);
+    free(paths.az);
+    return 0;
+}
@@ -0,0 +1,2828 @@
+/*
+** sqlite_ast.c - SQLite SELECT AST to JSON serializer (libsqlite_ast)
+**
+** This library parses a SQL SELECT statement using the official SQLite
+** parser and produces the raw (pre-resolution) AST as JSON. It works by
+** hooking into the parser's grammar action for "cmd ::= select(X)" to
+** capture the Select* before it is modified by sqlite3Select() or deleted,
+** and then stops the compilation so no time is spent on name resolution or
+** code generation.
+**
+** Build: see Makefile (patches sqlite3.c to insert the hook call). The
+** public API is declared in sqlite_ast.h; dump_ast.c is the command-line
+** front end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "sqlite_ast.h"
+
+/* ----------------------------------------------------------------
+ * Forward declaration of the hook function.
+ * The patched amalgamation calls this from the grammar action
+ * for "cmd ::= select(X)", passing the Parse* and Select* as void*.
+ * ---------------------------------------------------------------- */
+static void ast_capture_hook(void *parse_ptr, void *select_ptr);
+
+/* ----------------------------------------------------------------
+ * Include the patched SQLite amalgamation.
+ * This gives us access to all internal types (Select, Expr, etc.)
+ * ---------------------------------------------------------------- */
+#include "build/sqlite3_patched.c"
+
+/* ================================================================
+ * JSON Writer (pretty-printed with 2-space indentation)
+ *
+ * Output accumulates in buf, which grows geometrically as needed. When
+ * xWrite is set the buffer is instead handed to it each time it fills,
+ * so a huge tree is streamed in JW_CHUNK pieces with bounded memory.
+ *
+ * State machine:
+ *   needComma: next element needs a preceding comma
+ *   afterKey:  we just wrote "key": and the value follows inline
+ *   indent:    current nesting depth for indentation
+ *   compact:   no newlines or indentation (one line per document)
+ * ================================================================ */
+
+#define JW_CHUNK (64 * 1024)
+
+typedef struct JsonWriter {
+    char *buf;                  /* output buffer */
+    size_t cap;                 /* allocated size of buf */
+    size_t pos;                 /* bytes of pending output in buf */
+    sqlite_ast_write_fn xWrite; /* if set, buf is flushed here */
+    void *pWriteArg;            /* first argument to xWrite */
+    int oom;                    /* an allocation failed and output was lost */
+    int writeFailed;            /* xWrite reported an error */
+    size_t nFlushed;            /* bytes handed to xWrite so far */
+    int needComma;
+    int afterKey;
+    int indent;
+    int compact;
+} JsonWriter;
+
+/* Reset the JSON state machine for a new document */
+static void jw_init(JsonWriter *w) {
+    w->needComma = 0;
+    w->afterKey = 0;
+    w->indent = 0;
+}
+
+/* Hand any pending output to xWrite */
+static void jw_flush(JsonWriter *w) {
+    if (w->xWrite && w->pos > 0) {
+        if (!w->writeFailed && w->xWrite(w->pWriteArg, w->buf, w->pos) != 0) {
+            w->writeFailed = 1;
+        }
+        w->nFlushed += w->pos;
+        w->pos = 0;
+    }
+}
+
+/* Make room for n more bytes. Returns 0 if memory ran out. */
+static int jw_reserve(JsonWriter *w, size_t n) {
+    if (w->pos + n <= w->cap) return 1;
+    if (w->xWrite) {
+        jw_flush(w);
+        if (n <= w->cap) return 1;
+    }
+    size_t cap = w->cap ? w->cap : JW_CHUNK;
+    while (cap < w->pos + n) cap *= 2;
+    char *buf = realloc(w->buf, cap);
+    if (buf == NULL) {
+        w->oom = 1;
+        return 0;
+    }
+    w->buf = buf;
+    w->cap = cap;
+    return 1;
+}
+
+static void jw_raw_n(JsonWriter *w, const char *s, size_t len) {
+    if (jw_reserve(w, len)) {
+        memcpy(w->buf + w->pos, s, len);
+        w->pos += len;
+    }
+}
+
+/* Write a string literal; its length is known at compile time */
+#define JW_LIT(w, s) jw_raw_n(w, "" s, sizeof(s) - 1)
+
+/* Write a decimal integer */
+static void jw_raw_int(JsonWriter *w, int v) {
+    char tmp[12];
+    char *p = tmp + sizeof(tmp);
+    unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) *--p = '-';
+    jw_raw_n(w, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static void jw_newline(JsonWriter *w) {
+    if (w->compact) return;
+    size_t n = 1 + 2 * (size_t)w->indent;
+    if (!jw_reserve(w, n)) return;
+    w->buf[w->pos] = '\n';
+    memset(w->buf + w->pos + 1, ' ', n - 1);
+    w->pos += n;
+}
+
+/*
+** Before writing a new element (value, object, or array), call this
+** to handle commas and newlines. After a key, values go inline.
+*/
+static void jw_element_prefix(JsonWriter *w) {
+    if (w->afterKey) {
+        w->afterKey = 0;
+        /* Value follows "key": inline, no newline */
+    } else {
+        if (w->needComma) JW_LIT(w, ",");
+        jw_newline(w);
+    }
+    w->needComma = 0;
+}
+
+/* Bytes that cannot be copied into a JSON string as-is (NUL ends it) */
+static const unsigned char jw_special[256] = {
+    1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+    0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,
+};
+
+/* Escape sequences for control characters */
+static const char jw_ctrl_escape[0x20][7] = {
+    "\\u0000", "\\u0001", "\\u0002", "\\u0003",
+    "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+    "\\b",     "\\t",     "\\n",     "\\u000b",
+    "\\f",     "\\r",     "\\u000e", "\\u000f",
+    "\\u0010", "\\u0011", "\\u0012", "\\u0013",
+    "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+    "\\u0018", "\\u0019", "\\u001a", "\\u001b",
+    "\\u001c", "\\u001d", "\\u001e", "\\u001f",
+};
+
+/* ----------------------------------------------------------------
+ * Run scanners: return a pointer to the first byte at or after p that
+ * needs escaping or terminates the string (jw_special[*p] != 0).
+ *
+ * The vector versions only ever issue aligned loads, starting from the
+ * block that contains p and masking off the bytes before it. An aligned
+ * load never crosses a page boundary, so reading past the NUL within the
+ * final block cannot fault even though those bytes are not ours (memory
+ * checkers may still report them).
+ * ---------------------------------------------------------------- */
+
+/* Also the reference the vector versions are benchmarked against */
+static const unsigned char *jw_scan_scalar(const unsigned char *p) {
+    while (!jw_special[*p]) p++;
+    return p;
+}
+
+#if defined(__SSE2__)
+
+/* One bit per byte of v that is '"', '\\' or below 0x20 (including NUL) */
+static inline unsigned int jw_special_mask_sse2(__m128i v) {
+    __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    __m128i bslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+    return (unsigned int)_mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(quote, bslash), ctrl));
+}
+
+static const unsigned char *jw_scan_sse2(const unsigned char *p) {
+    size_t skip = (uintptr_t)p & 15;
+    const unsigned char *b = p - skip;
+    unsigned int mask =
+        jw_special_mask_sse2(_mm_load_si128((const __m128i *)b)) >> skip;
+    if (mask) return p + __builtin_ctz(mask);
+    for (;;) {
+        b += 16;
+        mask = jw_special_mask_sse2(_mm_load_si128((const __m128i *)b));
+        if (mask) return b + __builtin_ctz(mask);
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JW_HAVE_AVX2 1
+
+__attribute__((target("avx2")))
+static inline unsigned int jw_special_mask_avx2(__m256i v) {
+    __m256i quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+    __m256i bslash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'));
+    __m256i ctrl =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+    return (unsigned int)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_or_si256(quote, bslash), ctrl));
+}
+
+__attribute__((target("avx2")))
+static const unsigned char *jw_scan_avx2(const unsigned char *p) {
+    size_t skip = (uintptr_t)p & 31;
+    const unsigned char *b = p - skip;
+    unsigned int mask =
+        jw_special_mask_avx2(_mm256_load_si256((const __m256i *)b)) >> skip;
+    if (mask) return p + __builtin_ctz(mask);
+    for (;;) {
+        b += 32;
+        mask = jw_special_mask_avx2(_mm256_load_si256((const __m256i *)b));
+        if (mask) return b + __builtin_ctz(mask);
+    }
+}
+#endif /* __GNUC__ && x86 */
+#endif /* __SSE2__ */
+
+/*
+** The scanner in use: the widest implementation the CPU supports, chosen
+** once by jw_scan_init() before the first handle is opened.
+*/
+static const unsigned char *(*jw_scan)(const unsigned char *) = jw_scan_scalar;
+static pthread_once_t jw_scan_once = PTHREAD_ONCE_INIT;
+
+static void jw_scan_init(void) {
+#if defined(JW_HAVE_AVX2)
+    __builtin_cpu_init();
+    jw_scan = __builtin_cpu_supports("avx2") ? jw_scan_avx2 : jw_scan_sse2;
+#elif defined(__SSE2__)
+    jw_scan = jw_scan_sse2;
+#endif
+}
+
+/*
+** Write a JSON-escaped string (with quotes) - raw, no prefix handling.
+** Runs of bytes that need no escaping are found by jw_scan and copied in
+** one go.
+*/
+static void jw_quoted_string(JsonWriter *w, const char *s) {
+    JW_LIT(w, "\"");
+    if (s) {
+        const unsigned char *p = (const unsigned char *)s;
+        for (;;) {
+            const unsigned char *run = p;
+            p = jw_scan(p);
+            if (p > run) jw_raw_n(w, (const char *)run, (size_t)(p - run));
+            if (*p == 0) break;
+            if (*p == '"') {
+                JW_LIT(w, "\\\"");
+            } else if (*p == '\\') {
+                JW_LIT(w, "\\\\");
+            } else {
+                const char *esc = jw_ctrl_escape[*p];
+                jw_raw_n(w, esc, esc[2] ? 6 : 2);
+            }
+            p++;
+        }
+    }
+    JW_LIT(w, "\"");
+}
+
+static void jw_obj_start(JsonWriter *w) {
+    jw_element_prefix(w);
+    JW_LIT(w, "{");
+    w->indent++;
+    w->needComma = 0;
+}
+
+static void jw_obj_end(JsonWriter *w) {
+    w->indent--;
+    w->afterKey = 0;
+    jw_newline(w);
+    JW_LIT(w, "}");
+    w->needComma = 1;
+}
+
+static void jw_arr_start(JsonWriter *w) {
+    jw_element_prefix(w);
+    JW_LIT(w, "[");
+    w->indent++;
+    w->needComma = 0;
+}
+
+static void jw_arr_end(JsonWriter *w) {
+    w->indent--;
+    w->afterKey = 0;
+    jw_newline(w);
+    JW_LIT(w, "]");
+    w->needComma = 1;
+}
+
+/* Write "key": for a key of n bytes that needs no escaping */
+static void jw_key_n(JsonWriter *w, const char *k, size_t n) {
+    if (w->needComma) JW_LIT(w, ",");
+    jw_newline(w);
+    if (jw_reserve(w, n + 4)) {
+        char *z = w->buf + w->pos;
+        z[0] = '"';
+        memcpy(z + 1, k, n);
+        z[n + 1] = '"';
+        z[n + 2] = ':';
+        z[n + 3] = ' ';
+        w->pos += n + (w->compact ? 3 : 4);
+    }
+    w->needComma = 0;
+    w->afterKey = 1;
+}
+
+/* Write a string value ("" if s is NULL) */
+static void jw_str(JsonWriter *w, const char *s) {
+    jw_element_prefix(w);
+    jw_quoted_string(w, s);
+    w->needComma = 1;
+}
+
+/* Write a value that is already valid JSON text */
+static void jw_value_raw(JsonWriter *w, const char *z, size_t n) {
+    jw_element_prefix(w);
+    jw_raw_n(w, z, n);
+    w->needComma = 1;
+}
+
+/* Write a null value */
+static void jw_null(JsonWriter *w) {
+    jw_value_raw(w, "null", 4);
+}
+
+/* Write a boolean value */
+static void jw_bool(JsonWriter *w, int v) {
+    if (v) jw_value_raw(w, "true", 4); else jw_value_raw(w, "false", 5);
+}
+
+/* Write an integer value */
+static void jw_int(JsonWriter *w, int v) {
+    jw_element_prefix(w);
+    jw_raw_int(w, v);
+    w->needComma = 1;
+}
+
+/* ================================================================
+ * AST Vocabulary
+ *
+ * Every object key, and every string value drawn from a fixed set (node
+ * types, operators, join types, ...), has a small integer id. Emitters
+ * that are not writing JSON text can then map them to prebuilt objects or
+ * compact codes instead of handling strings.
+ *
+ * The CBOR output contains the ids themselves, and its decoder keeps a
+ * copy of both lists (sqlite_ast_conformance/cbor.py), so new entries go
+ * at the end of a list and existing ones are never reordered.
+ * ================================================================ */
+
+#define AST_KEYS(X) \
+    X(type) X(value) X(name) X(left) X(right) X(expr) X(as) X(operand) \
+    X(when_clauses) X(when) X(then) X(else) X(low) X(high) X(select) \
+    X(values) X(collation) X(args) X(distinct) X(order_by) X(over) X(op) \
+    X(action) X(message) X(text) X(alias) X(direction) X(nulls) X(schema) \
+    X(join_type) X(on) X(using) X(columns) X(materialized) X(base) \
+    X(partition_by) X(frame) X(start) X(end) X(exclude) X(filter) X(body) \
+    X(operator) X(all) X(from) X(where) X(group_by) X(having) X(limit) \
+    X(offset) X(with) X(window_definitions) \
+    /* Records of SQLITE_AST_ALL */ \
+    X(ast) X(error)
+
+#define AST_SYMS(X) \
+    /* Node types */ \
+    X(INTEGER, "integer") X(FLOAT, "float") X(STRING, "string") \
+    X(BLOB, "blob") X(NULL, "null") X(BOOLEAN, "boolean") X(NAME, "name") \
+    X(DOT, "dot") X(STAR, "star") X(PARAMETER, "parameter") X(CAST, "cast") \
+    X(CASE, "case") X(BETWEEN, "between") X(IN, "in") X(EXISTS, "exists") \
+    X(SUBQUERY, "subquery") X(COLLATE, "collate") X(FUNCTION, "function") \
+    X(UNARY, "unary") X(ISNULL, "isnull") X(NOTNULL, "notnull") \
+    X(TRUTH_TEST, "truth_test") X(RAISE, "raise") X(VECTOR, "vector") \
+    X(SPAN, "span") X(BINARY, "binary") X(UNKNOWN, "unknown") \
+    X(SELECT, "select") X(COMPOUND, "compound") X(TABLE, "table") \
+    /* Operators */ \
+    X(OP_AND, "AND") X(OP_OR, "OR") X(OP_LT, "<") X(OP_LE, "<=") \
+    X(OP_GT, ">") X(OP_GE, ">=") X(OP_EQ, "=") X(OP_NE, "!=") \
+    X(OP_IS, "IS") X(OP_ISNOT, "IS NOT") X(OP_PLUS, "+") X(OP_MINUS, "-") \
+    X(OP_STAR, "*") X(OP_SLASH, "/") X(OP_REM, "%") X(OP_BITAND, "&") \
+    X(OP_BITOR, "|") X(OP_LSHIFT, "<<") X(OP_RSHIFT, ">>") \
+    X(OP_CONCAT, "||") X(OP_LIKE, "LIKE") X(OP_MATCH, "MATCH") \
+    X(OP_BITNOT, "~") X(OP_NOT, "NOT") X(OP_IS_FALSE, "IS FALSE") \
+    X(OP_IS_TRUE, "IS TRUE") X(OP_IS_NOT_FALSE, "IS NOT FALSE") \
+    X(OP_IS_NOT_TRUE, "IS NOT TRUE") \
+    /* RAISE actions */ \
+    X(ROLLBACK, "ROLLBACK") X(ABORT, "ABORT") X(FAIL, "FAIL") \
+    X(IGNORE, "IGNORE") \
+    /* ORDER BY */ \
+    X(ASC, "ASC") X(DESC, "DESC") X(FIRST, "FIRST") X(LAST, "LAST") \
+    /* Joins */ \
+    X(JOIN, "JOIN") X(CROSS_JOIN, "CROSS JOIN") \
+    X(NATURAL_JOIN, "NATURAL JOIN") X(LEFT_JOIN, "LEFT JOIN") \
+    X(NATURAL_LEFT_JOIN, "NATURAL LEFT JOIN") X(RIGHT_JOIN, "RIGHT JOIN") \
+    X(NATURAL_RIGHT_JOIN, "NATURAL RIGHT JOIN") \
+    X(FULL_OUTER_JOIN, "FULL OUTER JOIN") \
+    X(NATURAL_FULL_OUTER_JOIN, "NATURAL FULL OUTER JOIN") \
+    /* CTE materialization */ \
+    X(MATERIALIZED, "MATERIALIZED") X(NOT_MATERIALIZED, "NOT MATERIALIZED") \
+    /* Window frames */ \
+    X(ROWS, "ROWS") X(RANGE, "RANGE") X(GROUPS, "GROUPS") \
+    X(UNBOUNDED, "UNBOUNDED") X(CURRENT_ROW, "CURRENT ROW") \
+    X(PRECEDING, "PRECEDING") X(FOLLOWING, "FOLLOWING") \
+    X(NO_OTHERS, "NO OTHERS") X(GROUP, "GROUP") X(TIES, "TIES") \
+    /* Compound operators */ \
+    X(UNION, "UNION") X(UNION_ALL, "UNION ALL") X(INTERSECT, "INTERSECT") \
+    X(EXCEPT, "EXCEPT")
+
+enum {
+#define X(k) AST_KEY_##k,
+    AST_KEYS(X)
+#undef X
+    AST_KEY_COUNT
+};
+
+enum {
+    AST_SYM_NONE,  /* no symbol: emitted as null */
+#define X(id, z) AST_SYM_##id,
+    AST_SYMS(X)
+#undef X
+    AST_SYM_COUNT
+};
+
+typedef struct AstName {
+    const char *z;
+    size_t n;
+} AstName;
+
+static const AstName ast_key_names[] = {
+#define X(k) { #k, sizeof(#k) - 1 },
+    AST_KEYS(X)
+#undef X
+};
+
+/* Symbol text, indexed by AST_SYM_* */
+static const AstName ast_sym_names[] = {
+    { NULL, 0 },
+#define X(id, z) { z, sizeof(z) - 1 },
+    AST_SYMS(X)
+#undef X
+};
+
+/* ================================================================
+ * Emitters
+ *
+ * The serializer below describes the tree as a sequence of events
+ * (start an object, a key, a value, ...) sent to an emitter. The JSON
+ * writer is the default emitter; others build different representations
+ * of the same tree without going through JSON text. Each callback gets the
+ * emitter's own state as its first argument.
+ * ================================================================ */
+
+typedef struct AstEmitter {
+    void (*xObjStart)(void *p);
+    void (*xObjEnd)(void *p);
+    void (*xArrStart)(void *p);
+    void (*xArrEnd)(void *p);
+    void (*xKey)(void *p, int eKey);      /* AST_KEY_*; the next event is its value */
+    void (*xSym)(void *p, int eSym);      /* AST_SYM_* other than AST_SYM_NONE */
+    void (*xStr)(void *p, const char *z); /* NULL is written as "" */
+    void (*xInt)(void *p, int v);
+    void (*xBool)(void *p, int v);
+    void (*xNull)(void *p);
+} AstEmitter;
+
+/*
+** Per-parse serializer state. Each handle owns one, registered as client
+** data on its connection so that the capture hook can find it; nothing is
+** shared between handles, so each thread can parse on its own handle.
+*/
+typedef struct AstCtx AstCtx;
+typedef struct AstTask AstTask;
+typedef struct AstStats AstStats;
+typedef struct AstSubtrees AstSubtrees;
+struct AstCtx {
+    const AstEmitter *pEmit;  /* where serializer events go */
+    void *pEmitArg;           /* state passed to pEmit's callbacks */
+    void (*xCapture)(AstCtx *c, Select *p);  /* what to do with the SELECT */
+    int captureEnabled;       /* a parse is in progress */
+    int captured;             /* the first SELECT has been seen */
+    AstTask *aTask;           /* serializer work stack, reused across parses */
+    int nTask;
+    int nTaskAlloc;
+    int oom;                  /* the work stack could not grow */
+    AstStats *pStats;         /* set if the handle records statistics */
+    AstSubtrees *pSubtrees;   /* set if the handle hashes subtrees */
+};
+
+/* Client data name the AstCtx is registered under */
+#define AST_CLIENTDATA "sqlite_ast"
+
+/* Symbols quoted as JSON strings, indexed like ast_sym_names */
+static const AstName jw_sym_quoted[] = {
+    { "null", 4 },
+#define X(id, z) { "\"" z "\"", sizeof(z) + 1 },
+    AST_SYMS(X)
+#undef X
+};
+
+/* The JSON writer as an emitter (p is the JsonWriter) */
+static void jw_e_obj_start(void *p) { jw_obj_start((JsonWriter *)p); }
+static void jw_e_obj_end(void *p) { jw_obj_end((JsonWriter *)p); }
+static void jw_e_arr_start(void *p) { jw_arr_start((JsonWriter *)p); }
+static void jw_e_arr_end(void *p) { jw_arr_end((JsonWriter *)p); }
+static void jw_e_str(void *p, const char *z) { jw_str((JsonWriter *)p, z); }
+static void jw_e_int(void *p, int v) { jw_int((JsonWriter *)p, v); }
+static void jw_e_bool(void *p, int v) { jw_bool((JsonWriter *)p, v); }
+static void jw_e_null(void *p) { jw_null((JsonWriter *)p); }
+
+static void jw_e_key(void *p, int eKey) {
+    jw_key_n((JsonWriter *)p, ast_key_names[eKey].z, ast_key_names[eKey].n);
+}
+
+static void jw_e_sym(void *p, int eSym) {
+    jw_value_raw((JsonWriter *)p, jw_sym_quoted[eSym].z, jw_sym_quoted[eSym].n);
+}
+
+static const AstEmitter jw_emitter = {
+    jw_e_obj_start, jw_e_obj_end, jw_e_arr_start, jw_e_arr_end,
+    jw_e_key, jw_e_sym, jw_e_str, jw_e_int, jw_e_bool, jw_e_null,
+};
+
+#define em_obj_start(c) (c)->pEmit->xObjStart((c)->pEmitArg)
+#define em_obj_end(c)   (c)->pEmit->xObjEnd((c)->pEmitArg)
+#define em_arr_start(c) (c)->pEmit->xArrStart((c)->pEmitArg)
+#define em_arr_end(c)   (c)->pEmit->xArrEnd((c)->pEmitArg)
+#define em_key(c, k)    (c)->pEmit->xKey((c)->pEmitArg, AST_KEY_##k)
+#define em_str(c, z)    (c)->pEmit->xStr((c)->pEmitArg, z)
+#define em_int(c, v)    (c)->pEmit->xInt((c)->pEmitArg, v)
+#define em_bool(c, v)   (c)->pEmit->xBool((c)->pEmitArg, v)
+#define em_null(c)      (c)->pEmit->xNull((c)->pEmitArg)
+
+/* Write a symbol, or null for AST_SYM_NONE */
+static void em_sym(AstCtx *c, int eSym) {
+    if (eSym) c->pEmit->xSym(c->pEmitArg, eSym); else em_null(c);
+}
+
+/* Write a string value, or null if z is NULL */
+static void em_str_or_null(AstCtx *c, const char *z) {
+    if (z) em_str(c, z); else em_null(c);
+}
+
+/* Convenience: "key": value pairs */
+#define em_key_sym(c, k, s)  do { em_key(c, k); em_sym(c, AST_SYM_##s); } while (0)
+#define em_key_symv(c, k, e) do { em_key(c, k); em_sym(c, e); } while (0)
+#define em_key_str(c, k, z)  do { em_key(c, k); em_str_or_null(c, z); } while (0)
+#define em_key_bool(c, k, v) do { em_key(c, k); em_bool(c, v); } while (0)
+#define em_key_null(c, k)    do { em_key(c, k); em_null(c); } while (0)
+
+/* ================================================================
+ * CBOR Emitter (SQLITE_AST_CBOR)
+ *
+ * Writes the tree as CBOR (RFC 8949) into a JsonWriter's buffer, so it
+ * is streamed and reused exactly like the JSON text. Objects and arrays
+ * are indefinite-length, since their sizes are not known up front, and
+ * end with a break byte. Keys are the unsigned integers AST_KEY_*, and
+ * symbols the simple values CB_SYM_BASE + AST_SYM_*, two bytes each.
+ * Every other value is the ordinary CBOR text string, integer, boolean
+ * or null, so the decoder needs only the two name tables to turn the
+ * result into the same tree as the JSON.
+ * ================================================================ */
+
+/* Simple values 0-31 are reserved or in use; 32-255 are unassigned */
+#define CB_SYM_BASE 31
+
+typedef char cb_syms_fit[CB_SYM_BASE + AST_SYM_COUNT - 1 <= 255 ? 1 : -1];
+
+/* Write the initial byte of major type m (0-7) and argument v */
+static void cb_head(JsonWriter *w, int m, uint32_t v) {
+    unsigned char *z;
+    if (!jw_reserve(w, 5)) return;
+    z = (unsigned char *)w->buf + w->pos;
+    if (v < 24) {
+        z[0] = (unsigned char)(m << 5 | v);
+        w->pos += 1;
+    } else if (v <= 0xff) {
+        z[0] = (unsigned char)(m << 5 | 24);
+        z[1] = (unsigned char)v;
+        w->pos += 2;
+    } else if (v <= 0xffff) {
+        z[0] = (unsigned char)(m << 5 | 25);
+        z[1] = (unsigned char)(v >> 8);
+        z[2] = (unsigned char)v;
+        w->pos += 3;
+    } else {
+        z[0] = (unsigned char)(m << 5 | 26);
+        z[1] = (unsigned char)(v >> 24);
+        z[2] = (unsigned char)(v >> 16);
+        z[3] = (unsigned char)(v >> 8);
+        z[4] = (unsigned char)v;
+        w->pos += 5;
+    }
+}
+
+static void cb_byte(JsonWriter *w, unsigned char c) {
+    if (jw_reserve(w, 1)) w->buf[w->pos++] = (char)c;
+}
+
+/* The CBOR writer as an emitter (p is the JsonWriter) */
+static void cb_e_obj_start(void *p) { cb_byte((JsonWriter *)p, 0xbf); }
+static void cb_e_arr_start(void *p) { cb_byte((JsonWriter *)p, 0x9f); }
+static void cb_e_end(void *p) { cb_byte((JsonWriter *)p, 0xff); }
+static void cb_e_key(void *p, int eKey) { cb_head((JsonWriter *)p, 0, (uint32_t)eKey); }
+static void cb_e_bool(void *p, int v) { cb_byte((JsonWriter *)p, v ? 0xf5 : 0xf4); }
+static void cb_e_null(void *p) { cb_byte((JsonWriter *)p, 0xf6); }
+
+static void cb_e_sym(void *p, int eSym) {
+    cb_head((JsonWriter *)p, 7, (uint32_t)(CB_SYM_BASE + eSym));
+}
+
+static void cb_e_str(void *p, const char *z) {
+    /* SQLite limits strings to well under 4GB */
+    size_t n = z ? strlen(z) : 0;
+    cb_head((JsonWriter *)p, 3, (uint32_t)n);
+    if (n) jw_raw_n((JsonWriter *)p, z, n);
+}
+
+static void cb_e_int(void *p, int v) {
+    if (v >= 0) {
+        cb_head((JsonWriter *)p, 0, (uint32_t)v);
+    } else {
+        cb_head((JsonWriter *)p, 1, (uint32_t)(-1 - (int64_t)v));
+    }
+}
+
+static const AstEmitter cb_emitter = {
+    cb_e_obj_start, cb_e_end, cb_e_arr_start, cb_e_end,
+    cb_e_key, cb_e_sym, cb_e_str, cb_e_int, cb_e_bool, cb_e_null,
+};
+
+/* ================================================================
+ * AST Serialization - Work Stack
+ *
+ * The serializer does not recurse on the C stack, so the depth of tree it
+ * can handle is bounded only by heap memory. Each json_* function below
+ * serializes one node: it emits the node's leading events directly, then
+ * queues everything from its first child onwards as tasks, in output
+ * order, in an AstSeq. serialize_select() pops and performs tasks until
+ * none are left. A list is walked one item per task (the task for item i
+ * queues that item followed by the task for item i+1), so long lists
+ * take no more stack than short ones.
+ *
+ * Within a json_* function, nothing may be emitted directly once anything
+ * has been added to its AstSeq.
+ * ================================================================ */
+
+/* Task kinds. List tasks take an index; index 0 also opens the array. */
+enum {
+    AST_TASK_KEY,             /* i: AST_KEY_* */
+    AST_TASK_SYM,             /* i: AST_SYM_* (AST_SYM_NONE is null) */
+    AST_TASK_STR,             /* p: string, or NULL for null */
+    AST_TASK_BOOL,            /* i: value */
+    AST_TASK_NULL,
+    AST_TASK_OBJ_START,
+    AST_TASK_OBJ_END,
+    AST_TASK_ARR_END,
+    AST_TASK_EXPR,            /* p: Expr */
+    AST_TASK_EXPR_LIST,       /* p: ExprList, i: item */
+    AST_TASK_CASE_WHEN,       /* p: ExprList of a CASE, i: item of a WHEN */
+    AST_TASK_RESULT_COLUMN,   /* p: ExprList, i: item */
+    AST_TASK_ORDER_BY,        /* p: ExprList, i: item */
+    AST_TASK_ID_LIST,         /* p: IdList */
+    AST_TASK_SRC_ITEM,        /* p: SrcList, i: item */
+    AST_TASK_CTE,             /* p: With, i: item */
+    AST_TASK_WINDOW,          /* p: Window */
+    AST_TASK_WINDOW_DEFN,     /* p: Window in a pNextWin chain, i: 0 if first */
+    AST_TASK_SELECT,          /* p: Select */
+    AST_TASK_COMPOUND_ARM,    /* p: Select in a pPrior chain */
+};
+
+struct AstTask {
+    int eTask;                /* AST_TASK_* */
+    int i;                    /* key, symbol, value or index */
+    const void *p;            /* node, list or string */
+};
+
+/* Tasks queued by one json_* function; the most (for a window) is 28 */
+#define AST_SEQ_MAX 32
+
+typedef struct AstSeq {
+    AstTask a[AST_SEQ_MAX];
+    int n;
+} AstSeq;
+
+static void seq_add(AstSeq *s, int eTask, const void *p, int i) {
+    assert(s->n < AST_SEQ_MAX);
+    s->a[s->n].eTask = eTask;
+    s->a[s->n].i = i;
+    s->a[s->n].p = p;
+    s->n++;
+}
+
+#define seq_key(s, k)        seq_add(s, AST_TASK_KEY, NULL, AST_KEY_##k)
+#define seq_sym(s, e)        seq_add(s, AST_TASK_SYM, NULL, e)
+#define seq_str(s, z)        seq_add(s, AST_TASK_STR, z, 0)
+#define seq_bool(s, v)       seq_add(s, AST_TASK_BOOL, NULL, v)
+#define seq_null(s)          seq_add(s, AST_TASK_NULL, NULL, 0)
+#define seq_obj_start(s)     seq_add(s, AST_TASK_OBJ_START, NULL, 0)
+#define seq_obj_end(s)       seq_add(s, AST_TASK_OBJ_END, NULL, 0)
+#define seq_arr_end(s)       seq_add(s, AST_TASK_ARR_END, NULL, 0)
+#define seq_node(s, T, p)    seq_add(s, AST_TASK_##T, p, 0)
+#define seq_item(s, T, p, i) seq_add(s, AST_TASK_##T, p, i)
+
+/* Make room for n more tasks. Returns 0, with c->oom set, on failure. */
+static int ast_reserve(AstCtx *c, int n) {
+    if (c->nTask + n <= c->nTaskAlloc) return 1;
+    int nAlloc = c->nTaskAlloc ? c->nTaskAlloc : 256;
+    while (nAlloc < c->nTask + n) nAlloc *= 2;
+    AstTask *aTask = realloc(c->aTask, nAlloc * sizeof(AstTask));
+    if (aTask == NULL) {
+        c->oom = 1;
+        return 0;
+    }
+    c->aTask = aTask;
+    c->nTaskAlloc = nAlloc;
+    return 1;
+}
+
+/*
+** Push the tasks in s so that they are performed in the order they were
+** added. If the stack cannot grow, c->oom is set and the tasks are lost.
+*/
+static void ast_queue(AstCtx *c, const AstSeq *s) {
+    if (!ast_reserve(c, s->n)) return;
+    for (int i = s->n - 1; i >= 0; i--) {
+        c->aTask[c->nTask++] = s->a[i];
+    }
+}
+
+/* Push a single task, to be performed before those already queued */
+static void ast_push(AstCtx *c, int eTask, const void *p) {
+    if (!ast_reserve(c, 1)) return;
+    c->aTask[c->nTask].eTask = eTask;
+    c->aTask[c->nTask].i = 0;
+    c->aTask[c->nTask].p = p;
+    c->nTask++;
+}
+
+/* ================================================================
+ * AST Serialization - Expressions
+ * ================================================================ */
+
+/* Map a TK_ binary operator to its symbol (AST_SYM_NONE if not binary) */
+static int binop_sym(int op) {
+    switch (op) {
+        case TK_AND:     return AST_SYM_OP_AND;
+        case TK_OR:      return AST_SYM_OP_OR;
+        case TK_LT:      return AST_SYM_OP_LT;
+        case TK_LE:      return AST_SYM_OP_LE;
+        case TK_GT:      return AST_SYM_OP_GT;
+        case TK_GE:      return AST_SYM_OP_GE;
+        case TK_EQ:      return AST_SYM_OP_EQ;
+        case TK_NE:      return AST_SYM_OP_NE;
+        case TK_IS:      return AST_SYM_OP_IS;
+        case TK_ISNOT:   return AST_SYM_OP_ISNOT;
+        case TK_PLUS:    return AST_SYM_OP_PLUS;
+        case TK_MINUS:   return AST_SYM_OP_MINUS;
+        case TK_STAR:    return AST_SYM_OP_STAR;
+        case TK_SLASH:   return AST_SYM_OP_SLASH;
+        case TK_REM:     return AST_SYM_OP_REM;
+        case TK_BITAND:  return AST_SYM_OP_BITAND;
+        case TK_BITOR:   return AST_SYM_OP_BITOR;
+        case TK_LSHIFT:  return AST_SYM_OP_LSHIFT;
+        case TK_RSHIFT:  return AST_SYM_OP_RSHIFT;
+        case TK_CONCAT:  return AST_SYM_OP_CONCAT;
+        case TK_LIKE_KW: return AST_SYM_OP_LIKE;
+        case TK_MATCH:   return AST_SYM_OP_MATCH;
+        default: return AST_SYM_NONE;
+    }
+}
+
+static void json_expr(AstCtx *c, const Expr *pExpr) {
+    AstSeq s;
+    s.n = 0;
+
+    if (pExpr == NULL) {
+        em_null(c);
+        return;
+    }
+
+    em_obj_start(c);
+
+    switch (pExpr->op) {
+
+    case TK_INTEGER: {
+        em_key_sym(c, type, INTEGER);
+        em_key(c, value);
+        if (pExpr->flags & EP_IntValue) {
+            em_int(c, pExpr->u.iValue);
+        } else {
+            em_str(c, pExpr->u.zToken);
+        }
+        break;
+    }
+
+    case TK_FLOAT: {
+        em_key_sym(c, type, FLOAT);
+        em_key_str(c, value, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_STRING: {
+        em_key_sym(c, type, STRING);
+        em_key_str(c, value, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_BLOB: {
+        em_key_sym(c, type, BLOB);
+        em_key_str(c, value, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_NULL: {
+        em_key_sym(c, type, NULL);
+        break;
+    }
+
+    case TK_TRUEFALSE: {
+        em_key_sym(c, type, BOOLEAN);
+        em_key_bool(c, value, sqlite3ExprTruthValue(pExpr));
+        break;
+    }
+
+    case TK_ID: {
+        em_key_sym(c, type, NAME);
+        em_key_str(c, name, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_DOT: {
+        em_key_sym(c, type, DOT);
+        em_key(c, left);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        seq_key(&s, right);
+        seq_node(&s, EXPR, pExpr->pRight);
+        break;
+    }
+
+    case TK_ASTERISK: {
+        em_key_sym(c, type, STAR);
+        break;
+    }
+
+    case TK_VARIABLE: {
+        em_key_sym(c, type, PARAMETER);
+        em_key_str(c, name, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_CAST: {
+        em_key_sym(c, type, CAST);
+        em_key(c, expr);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        seq_key(&s, as);
+        seq_str(&s, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_CASE: {
+        const ExprList *pList = pExpr->x.pList;
+        em_key_sym(c, type, CASE);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        if (pList) {
+            seq_key(&s, when_clauses);
+            seq_item(&s, CASE_WHEN, pList, 0);
+            /* The last item, if odd count, is ELSE */
+            seq_key(&s, else);
+            if (pList->nExpr % 2 == 1) {
+                seq_node(&s, EXPR, pList->a[pList->nExpr - 1].pExpr);
+            } else {
+                seq_null(&s);
+            }
+        }
+        break;
+    }
+
+    case TK_BETWEEN: {
+        em_key_sym(c, type, BETWEEN);
+        em_key(c, expr);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        seq_key(&s, low);
+        seq_node(&s, EXPR, pExpr->x.pList->a[0].pExpr);
+        seq_key(&s, high);
+        seq_node(&s, EXPR, pExpr->x.pList->a[1].pExpr);
+        break;
+    }
+
+    case TK_IN: {
+        em_key_sym(c, type, IN);
+        em_key(c, expr);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        if (pExpr->flags & EP_xIsSelect) {
+            seq_key(&s, select);
+            seq_node(&s, SELECT, pExpr->x.pSelect);
+        } else {
+            seq_key(&s, values);
+            seq_node(&s, EXPR_LIST, pExpr->x.pList);
+        }
+        break;
+    }
+
+    case TK_EXISTS: {
+        em_key_sym(c, type, EXISTS);
+        em_key(c, select);
+        seq_node(&s, SELECT, pExpr->x.pSelect);
+        break;
+    }
+
+    case TK_SELECT: {
+        em_key_sym(c, type, SUBQUERY);
+        em_key(c, select);
+        seq_node(&s, SELECT, pExpr->x.pSelect);
+        break;
+    }
+
+    case TK_COLLATE: {
+        em_key_sym(c, type, COLLATE);
+        em_key(c, expr);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        seq_key(&s, collation);
+        seq_str(&s, pExpr->u.zToken);
+        break;
+    }
+
+    case TK_FUNCTION:
+    case TK_AGG_FUNCTION: {
+        em_key_sym(c, type, FUNCTION);
+        em_key_str(c, name, pExpr->u.zToken);
+        em_key(c, args);
+        if (!ExprHasProperty(pExpr, EP_TokenOnly) && pExpr->x.pList) {
+            seq_node(&s, EXPR_LIST, pExpr->x.pList);
+        } else {
+            em_arr_start(c);
+            em_arr_end(c);
+        }
+        seq_key(&s, distinct);
+        seq_bool(&s, (pExpr->flags & EP_Distinct) ? 1 : 0);
+        /* ORDER BY within aggregate function */
+        if (pExpr->pLeft && pExpr->pLeft->op == TK_ORDER) {
+            seq_key(&s, order_by);
+            seq_node(&s, EXPR_LIST, pExpr->pLeft->x.pList);
+        }
+#ifndef SQLITE_OMIT_WINDOWFUNC
+        if (IsWindowFunc(pExpr) && pExpr->y.pWin) {
+            seq_key(&s, over);
+            seq_node(&s, WINDOW, pExpr->y.pWin);
+        }
+#endif
+        break;
+    }
+
+    case TK_UMINUS: {
+        em_key_sym(c, type, UNARY);
+        em_key_sym(c, op, OP_MINUS);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_UPLUS: {
+        em_key_sym(c, type, UNARY);
+        em_key_sym(c, op, OP_PLUS);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_BITNOT: {
+        em_key_sym(c, type, UNARY);
+        em_key_sym(c, op, OP_BITNOT);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_NOT: {
+        em_key_sym(c, type, UNARY);
+        em_key_sym(c, op, OP_NOT);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_ISNULL: {
+        em_key_sym(c, type, ISNULL);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_NOTNULL: {
+        em_key_sym(c, type, NOTNULL);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_TRUTH: {
+        /* IS TRUE, IS FALSE, IS NOT TRUE, IS NOT FALSE */
+        int isNot = (pExpr->op2 == TK_ISNOT);
+        int isTrue = sqlite3ExprTruthValue(pExpr->pRight);
+        static const int ops[] = {
+            AST_SYM_OP_IS_FALSE, AST_SYM_OP_IS_TRUE,
+            AST_SYM_OP_IS_NOT_FALSE, AST_SYM_OP_IS_NOT_TRUE
+        };
+        em_key_sym(c, type, TRUTH_TEST);
+        em_key_symv(c, op, ops[isNot * 2 + isTrue]);
+        em_key(c, operand);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    case TK_RAISE: {
+        em_key_sym(c, type, RAISE);
+        int eAction = AST_SYM_UNKNOWN;
+        switch (pExpr->affExpr) {
+            case OE_Rollback: eAction = AST_SYM_ROLLBACK; break;
+            case OE_Abort:    eAction = AST_SYM_ABORT;    break;
+            case OE_Fail:     eAction = AST_SYM_FAIL;     break;
+            case OE_Ignore:   eAction = AST_SYM_IGNORE;   break;
+        }
+        em_key_symv(c, action, eAction);
+        if (pExpr->u.zToken) {
+            em_key_str(c, message, pExpr->u.zToken);
+        }
+        break;
+    }
+
+    case TK_VECTOR: {
+        em_key_sym(c, type, VECTOR);
+        em_key(c, values);
+        seq_node(&s, EXPR_LIST, pExpr->x.pList);
+        break;
+    }
+
+    case TK_SPAN: {
+        /* SPAN wraps an expression with its original SQL text */
+        em_key_sym(c, type, SPAN);
+        em_key_str(c, text, pExpr->u.zToken);
+        em_key(c, expr);
+        seq_node(&s, EXPR, pExpr->pLeft);
+        break;
+    }
+
+    default: {
+        /* Binary operators */
+        int eOp = binop_sym(pExpr->op);
+        if (eOp && pExpr->pLeft && pExpr->pRight) {
+            em_key_sym(c, type, BINARY);
+            em_key_symv(c, op, eOp);
+            em_key(c, left);
+            seq_node(&s, EXPR, pExpr->pLeft);
+            seq_key(&s, right);
+            seq_node(&s, EXPR, pExpr->pRight);
+        } else {
+            /* Fallback: output the opcode number */
+            em_key_sym(c, type, UNKNOWN);
+            em_key(c, op);
+            em_int(c, pExpr->op);
+        }
+        break;
+    }
+
+    } /* end switch */
+
+    seq_obj_end(&s);
+    ast_queue(c, &s);
+}
+
+/* One WHEN/THEN pair of a CASE, then the pair after it */
+static void json_case_when(AstCtx *c, const ExprList *pList, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (i == 0) em_arr_start(c);
+    if (i + 1 >= pList->nExpr) {
+        em_arr_end(c);
+        return;
+    }
+    em_obj_start(c);
+    em_key(c, when);
+    seq_node(&s, EXPR, pList->a[i].pExpr);
+    seq_key(&s, then);
+    seq_node(&s, EXPR, pList->a[i + 1].pExpr);
+    seq_obj_end(&s);
+    seq_item(&s, CASE_WHEN, pList, i + 2);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - Expression Lists
+ *
+ * Each of these serializes item i of its list and queues item i + 1; the
+ * task for item 0 also opens the array (or writes null for no list).
+ * ================================================================ */
+
+static void json_expr_list(AstCtx *c, const ExprList *pList, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (pList == NULL) {
+        em_null(c);
+        return;
+    }
+    if (i == 0) em_arr_start(c);
+    if (i >= pList->nExpr) {
+        em_arr_end(c);
+        return;
+    }
+    seq_node(&s, EXPR, pList->a[i].pExpr);
+    seq_item(&s, EXPR_LIST, pList, i + 1);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - Result Columns
+ * (Like ExprList but includes alias info)
+ * ================================================================ */
+
+static void json_result_column(AstCtx *c, const ExprList *pList, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (pList == NULL) {
+        em_null(c);
+        return;
+    }
+    if (i == 0) em_arr_start(c);
+    if (i >= pList->nExpr) {
+        em_arr_end(c);
+        return;
+    }
+    em_obj_start(c);
+    em_key(c, expr);
+    seq_node(&s, EXPR, pList->a[i].pExpr);
+    /* Alias: only output if this is an explicit AS name */
+    seq_key(&s, alias);
+    if (pList->a[i].zEName && pList->a[i].fg.eEName == ENAME_NAME) {
+        seq_str(&s, pList->a[i].zEName);
+    } else {
+        seq_null(&s);
+    }
+    seq_obj_end(&s);
+    seq_item(&s, RESULT_COLUMN, pList, i + 1);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - ORDER BY Columns
+ * (Like ExprList but includes direction)
+ * ================================================================ */
+
+static void json_order_by(AstCtx *c, const ExprList *pList, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (pList == NULL) {
+        em_null(c);
+        return;
+    }
+    if (i == 0) em_arr_start(c);
+    if (i >= pList->nExpr) {
+        em_arr_end(c);
+        return;
+    }
+    em_obj_start(c);
+    em_key(c, expr);
+    seq_node(&s, EXPR, pList->a[i].pExpr);
+    seq_key(&s, direction);
+    if (pList->a[i].fg.sortFlags & KEYINFO_ORDER_DESC) {
+        seq_sym(&s, AST_SYM_DESC);
+    } else {
+        seq_sym(&s, AST_SYM_ASC);
+    }
+    if (pList->a[i].fg.bNulls) {
+        seq_key(&s, nulls);
+        if (pList->a[i].fg.sortFlags & KEYINFO_ORDER_BIGNULL) {
+            seq_sym(&s, AST_SYM_LAST);
+        } else {
+            seq_sym(&s, AST_SYM_FIRST);
+        }
+    }
+    seq_obj_end(&s);
+    seq_item(&s, ORDER_BY, pList, i + 1);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - Id List (for USING clauses)
+ * ================================================================ */
+
+static void json_id_list(AstCtx *c, const IdList *pList) {
+    if (pList == NULL) {
+        em_null(c);
+        return;
+    }
+    em_arr_start(c);
+    for (int i = 0; i < pList->nId; i++) {
+        em_str(c, pList->a[i].zName);
+    }
+    em_arr_end(c);
+}
+
+/* ================================================================
+ * AST Serialization - FROM Clause (SrcList)
+ * ================================================================ */
+
+static int join_type_sym(u8 jt) {
+    if (jt == 0) return AST_SYM_NONE; /* no explicit join, just comma-separated */
+
+    /* Check for FULL OUTER JOIN first */
+    if ((jt & (JT_LEFT | JT_RIGHT)) == (JT_LEFT | JT_RIGHT)) {
+        if (jt & JT_NATURAL) return AST_SYM_NATURAL_FULL_OUTER_JOIN;
+        return AST_SYM_FULL_OUTER_JOIN;
+    }
+    if (jt & JT_LEFT) {
+        if (jt & JT_NATURAL) return AST_SYM_NATURAL_LEFT_JOIN;
+        return AST_SYM_LEFT_JOIN;
+    }
+    if (jt & JT_RIGHT) {
+        if (jt & JT_NATURAL) return AST_SYM_NATURAL_RIGHT_JOIN;
+        return AST_SYM_RIGHT_JOIN;
+    }
+    if (jt & JT_CROSS) {
+        return AST_SYM_CROSS_JOIN;
+    }
+    if (jt & JT_NATURAL) {
+        return AST_SYM_NATURAL_JOIN;
+    }
+    if (jt & JT_INNER) {
+        return AST_SYM_JOIN;
+    }
+    return AST_SYM_NONE;
+}
+
+static void json_src_item(AstCtx *c, const SrcList *pSrc, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (pSrc == NULL || pSrc->nSrc == 0) {
+        em_null(c);
+        return;
+    }
+    if (i == 0) em_arr_start(c);
+    if (i >= pSrc->nSrc) {
+        em_arr_end(c);
+        return;
+    }
+
+    const SrcItem *pItem = &pSrc->a[i];
+    em_obj_start(c);
+
+    if (pItem->fg.isSubquery) {
+        em_key_sym(c, type, SUBQUERY);
+        em_key(c, select);
+        seq_node(&s, SELECT, pItem->u4.pSubq->pSelect);
+    } else {
+        em_key_sym(c, type, TABLE);
+        em_key_str(c, name, pItem->zName);
+        if (pItem->u4.zDatabase && !pItem->fg.fixedSchema) {
+            em_key_str(c, schema, pItem->u4.zDatabase);
+        }
+    }
+
+    seq_key(&s, alias);
+    seq_str(&s, pItem->zAlias);
+
+    /* Join type */
+    seq_key(&s, join_type);
+    seq_sym(&s, join_type_sym(pItem->fg.jointype));
+
+    /* ON clause */
+    if (pItem->fg.isOn || pItem->u3.pOn) {
+        seq_key(&s, on);
+        seq_node(&s, EXPR, pItem->u3.pOn);
+    }
+
+    /* USING clause */
+    if (pItem->fg.isUsing && pItem->u3.pUsing) {
+        seq_key(&s, using);
+        seq_node(&s, ID_LIST, pItem->u3.pUsing);
+    }
+
+    /* Table-valued function arguments */
+    if (pItem->fg.isTabFunc && pItem->u1.pFuncArg) {
+        seq_key(&s, args);
+        seq_node(&s, EXPR_LIST, pItem->u1.pFuncArg);
+    }
+
+    seq_obj_end(&s);
+    seq_item(&s, SRC_ITEM, pSrc, i + 1);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - WITH / CTE
+ * ================================================================ */
+
+static void json_cte(AstCtx *c, const With *pWith, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (pWith == NULL) {
+        em_null(c);
+        return;
+    }
+    if (i == 0) em_arr_start(c);
+    if (i >= pWith->nCte) {
+        em_arr_end(c);
+        return;
+    }
+
+    const Cte *pCte = &pWith->a[i];
+    em_obj_start(c);
+    em_key_str(c, name, pCte->zName);
+    /* Column list */
+    if (pCte->pCols && pCte->pCols->nExpr > 0) {
+        em_key(c, columns);
+        em_arr_start(c);
+        for (int j = 0; j < pCte->pCols->nExpr; j++) {
+            em_str(c, pCte->pCols->a[j].zEName);
+        }
+        em_arr_end(c);
+    }
+    /* Materialization hint */
+    if (pCte->eM10d == M10d_Yes) {
+        em_key_sym(c, materialized, MATERIALIZED);
+    } else if (pCte->eM10d == M10d_No) {
+        em_key_sym(c, materialized, NOT_MATERIALIZED);
+    }
+    /* The CTE body */
+    em_key(c, select);
+    seq_node(&s, SELECT, pCte->pSelect);
+    seq_obj_end(&s);
+    seq_item(&s, CTE, pWith, i + 1);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - Window Definitions
+ * ================================================================ */
+
+#ifndef SQLITE_OMIT_WINDOWFUNC
+static int frame_bound_sym(u8 bound) {
+    switch (bound) {
+        case TK_UNBOUNDED: return AST_SYM_UNBOUNDED;
+        case TK_CURRENT:   return AST_SYM_CURRENT_ROW;
+        case TK_PRECEDING: return AST_SYM_PRECEDING;
+        case TK_FOLLOWING: return AST_SYM_FOLLOWING;
+        default: return AST_SYM_UNKNOWN;
+    }
+}
+
+static void json_window(AstCtx *c, const Window *pWin) {
+    AstSeq s;
+    s.n = 0;
+    if (pWin == NULL) {
+        em_null(c);
+        return;
+    }
+    em_obj_start(c);
+    em_key_str(c, name, pWin->zName);
+    em_key_str(c, base, pWin->zBase);
+
+    if (pWin->pPartition) {
+        seq_key(&s, partition_by);
+        seq_node(&s, EXPR_LIST, pWin->pPartition);
+    }
+
+    if (pWin->pOrderBy) {
+        seq_key(&s, order_by);
+        seq_node(&s, ORDER_BY, pWin->pOrderBy);
+    }
+
+    if (pWin->eFrmType != 0 && pWin->eFrmType != TK_FILTER) {
+        seq_key(&s, frame);
+        seq_obj_start(&s);
+        int eFrmType = AST_SYM_ROWS;
+        if (pWin->eFrmType == TK_RANGE) eFrmType = AST_SYM_RANGE;
+        if (pWin->eFrmType == TK_GROUPS) eFrmType = AST_SYM_GROUPS;
+        seq_key(&s, type);
+        seq_sym(&s, eFrmType);
+
+        seq_key(&s, start);
+        seq_obj_start(&s);
+        seq_key(&s, type);
+        seq_sym(&s, frame_bound_sym(pWin->eStart));
+        if (pWin->pStart) {
+            seq_key(&s, expr);
+            seq_node(&s, EXPR, pWin->pStart);
+        }
+        seq_obj_end(&s);
+
+        seq_key(&s, end);
+        seq_obj_start(&s);
+        seq_key(&s, type);
+        seq_sym(&s, frame_bound_sym(pWin->eEnd));
+        if (pWin->pEnd) {
+            seq_key(&s, expr);
+            seq_node(&s, EXPR, pWin->pEnd);
+        }
+        seq_obj_end(&s);
+
+        if (pWin->eExclude) {
+            int eExclude = AST_SYM_UNKNOWN;
+            switch (pWin->eExclude) {
+                case TK_NO:      eExclude = AST_SYM_NO_OTHERS; break;
+                case TK_CURRENT: eExclude = AST_SYM_CURRENT_ROW; break;
+                case TK_GROUP:   eExclude = AST_SYM_GROUP; break;
+                case TK_TIES:    eExclude = AST_SYM_TIES; break;
+            }
+            seq_key(&s, exclude);
+            seq_sym(&s, eExclude);
+        }
+        seq_obj_end(&s);
+    }
+
+    if (pWin->pFilter) {
+        seq_key(&s, filter);
+        seq_node(&s, EXPR, pWin->pFilter);
+    }
+
+    seq_obj_end(&s);
+    ast_queue(c, &s);
+}
+
+/* Named window definitions (WINDOW w AS (...)): pWin, then the rest */
+static void json_window_defn(AstCtx *c, const Window *pWin, int i) {
+    AstSeq s;
+    s.n = 0;
+    if (i == 0) em_arr_start(c);
+    if (pWin == NULL) {
+        em_arr_end(c);
+        return;
+    }
+    seq_node(&s, WINDOW, pWin);
+    seq_item(&s, WINDOW_DEFN, pWin->pNextWin, 1);
+    ast_queue(c, &s);
+}
+#endif /* SQLITE_OMIT_WINDOWFUNC */
+
+/* ================================================================
+ * AST Serialization - SELECT Statement
+ * ================================================================ */
+
+/* LIMIT and OFFSET, shared by simple and compound selects */
+static void seq_limit(AstSeq *s, const Select *p) {
+    seq_key(s, limit);
+    if (p->pLimit) {
+        seq_node(s, EXPR, p->pLimit->pLeft);
+        seq_key(s, offset);
+        seq_node(s, EXPR, p->pLimit->pRight);
+    } else {
+        seq_null(s);
+    }
+}
+
+/*
+** One arm of a compound select (its non-compound parts), with the
+** operator that joins it to the arm before it, if any.
+*/
+static void json_compound_arm(AstCtx *c, const Select *p) {
+    AstSeq s;
+    s.n = 0;
+    em_obj_start(c);
+    if (p->pPrior) {
+        /* The operator is stored on the right side of the compound */
+        int eOp = AST_SYM_UNION;
+        switch (p->op) {
+            case TK_ALL:       eOp = AST_SYM_UNION_ALL; break;
+            case TK_INTERSECT: eOp = AST_SYM_INTERSECT; break;
+            case TK_EXCEPT:    eOp = AST_SYM_EXCEPT;    break;
+        }
+        em_key_symv(c, operator, eOp);
+    }
+    em_key(c, select);
+    em_obj_start(c);
+    em_key_sym(c, type, SELECT);
+    em_key_bool(c, distinct, (p->selFlags & SF_Distinct) ? 1 : 0);
+    em_key_bool(c, all, (p->selFlags & SF_All) ? 1 : 0);
+    em_key(c, columns);
+    seq_node(&s, RESULT_COLUMN, p->pEList);
+    seq_key(&s, from);
+    seq_node(&s, SRC_ITEM, p->pSrc);
+    seq_key(&s, where);
+    seq_node(&s, EXPR, p->pWhere);
+    seq_key(&s, group_by);
+    seq_node(&s, EXPR_LIST, p->pGroupBy);
+    seq_key(&s, having);
+    seq_node(&s, EXPR, p->pHaving);
+    /* Note: ORDER BY and LIMIT are on the outermost select only */
+    seq_obj_end(&s);
+    seq_obj_end(&s);
+    ast_queue(c, &s);
+}
+
+static void json_select(AstCtx *c, const Select *p) {
+    AstSeq s;
+    s.n = 0;
+    if (p == NULL) {
+        em_null(c);
+        return;
+    }
+
+    /*
+    ** For compound selects (UNION, INTERSECT, EXCEPT), walk the chain.
+    ** The chain via pPrior goes: rightmost → ... → leftmost. Pushing one
+    ** task per arm in that order leaves the leftmost on top of the stack,
+    ** so the arms come out left to right with no array to reverse them.
+    */
+    if (p->pPrior) {
+        em_obj_start(c);
+        em_key_sym(c, type, COMPOUND);
+        em_key(c, body);
+        em_arr_start(c);
+        /* ORDER BY and LIMIT apply to the whole compound */
+        seq_arr_end(&s);
+        seq_key(&s, order_by);
+        seq_node(&s, ORDER_BY, p->pOrderBy);
+        seq_limit(&s, p);
+        seq_obj_end(&s);
+        ast_queue(c, &s);
+        for (const Select *q = p; q != NULL; q = q->pPrior) {
+            ast_push(c, AST_TASK_COMPOUND_ARM, q);
+        }
+        return;
+    }
+
+    /* Simple (non-compound) select */
+    em_obj_start(c);
+    em_key_sym(c, type, SELECT);
+    em_key_bool(c, distinct, (p->selFlags & SF_Distinct) ? 1 : 0);
+    em_key_bool(c, all, (p->selFlags & SF_All) ? 1 : 0);
+
+    /* WITH clause */
+    if (p->pWith) {
+        seq_key(&s, with);
+        seq_node(&s, CTE, p->pWith);
+    }
+
+    /* Result columns */
+    seq_key(&s, columns);
+    seq_node(&s, RESULT_COLUMN, p->pEList);
+
+    /* FROM clause */
+    seq_key(&s, from);
+    seq_node(&s, SRC_ITEM, p->pSrc);
+
+    /* WHERE clause */
+    seq_key(&s, where);
+    seq_node(&s, EXPR, p->pWhere);
+
+    /* GROUP BY */
+    seq_key(&s, group_by);
+    seq_node(&s, EXPR_LIST, p->pGroupBy);
+
+    /* HAVING */
+    seq_key(&s, having);
+    seq_node(&s, EXPR, p->pHaving);
+
+#ifndef SQLITE_OMIT_WINDOWFUNC
+    /* Named window definitions (WINDOW w AS (...)) */
+    if (p->pWinDefn) {
+        seq_key(&s, window_definitions);
+        seq_node(&s, WINDOW_DEFN, p->pWinDefn);
+    }
+#endif
+
+    /* ORDER BY */
+    seq_key(&s, order_by);
+    seq_node(&s, ORDER_BY, p->pOrderBy);
+
+    /* LIMIT / OFFSET */
+    seq_limit(&s, p);
+
+    seq_obj_end(&s);
+    ast_queue(c, &s);
+}
+
+/* ================================================================
+ * AST Serialization - Driver
+ * ================================================================ */
+
+/*
+** Serialize the tree rooted at p to c's emitter. If the work stack runs
+** out of memory, c->oom is set and the output is incomplete.
+*/
+static void serialize_select(AstCtx *c, const Select *p) {
+    c->nTask = 0;
+    json_select(c, p);
+    while (c->nTask > 0 && !c->oom) {
+        AstTask t = c->aTask[--c->nTask];
+        switch (t.eTask) {
+            case AST_TASK_KEY:       c->pEmit->xKey(c->pEmitArg, t.i); break;
+            case AST_TASK_SYM:       em_sym(c, t.i); break;
+            case AST_TASK_STR:       em_str_or_null(c, (const char *)t.p); break;
+            case AST_TASK_BOOL:      em_bool(c, t.i); break;
+            case AST_TASK_NULL:      em_null(c); break;
+            case AST_TASK_OBJ_START: em_obj_start(c); break;
+            case AST_TASK_OBJ_END:   em_obj_end(c); break;
+            case AST_TASK_ARR_END:   em_arr_end(c); break;
+            case AST_TASK_EXPR:      json_expr(c, t.p); break;
+            case AST_TASK_EXPR_LIST: json_expr_list(c, t.p, t.i); break;
+            case AST_TASK_CASE_WHEN: json_case_when(c, t.p, t.i); break;
+            case AST_TASK_RESULT_COLUMN: json_result_column(c, t.p, t.i); break;
+            case AST_TASK_ORDER_BY:  json_order_by(c, t.p, t.i); break;
+            case AST_TASK_ID_LIST:   json_id_list(c, t.p); break;
+            case AST_TASK_SRC_ITEM:  json_src_item(c, t.p, t.i); break;
+            case AST_TASK_CTE:       json_cte(c, t.p, t.i); break;
+#ifndef SQLITE_OMIT_WINDOWFUNC
+            case AST_TASK_WINDOW:    json_window(c, t.p); break;
+            case AST_TASK_WINDOW_DEFN: json_window_defn(c, t.p, t.i); break;
+#endif
+            case AST_TASK_SELECT:    json_select(c, t.p); break;
+            case AST_TASK_COMPOUND_ARM: json_compound_arm(c, t.p); break;
+        }
+    }
+}
+
+/* ================================================================
+ * Statistics (SQLITE_AST_STATS)
+ *
+ * A handle opened with SQLITE_AST_STATS times each phase of every parse,
+ * counts the nodes of the tree by type and samples SQLite's memory
+ * counters. Nodes are counted by an emitter placed in front of the real
+ * one for the duration of the parse: it counts the symbol that follows
+ * each "type" key and passes every event on unchanged.
+ * ================================================================ */
+
+struct AstStats {
+    const AstEmitter *pEmit;     /* the emitter being counted */
+    void *pEmitArg;
+    int afterType;               /* the last event was the "type" key */
+    int aNode[AST_SYM_COUNT];    /* node counts by AST_SYM_* type */
+    sqlite3_int64 nsOpen;        /* time spent in sqlite_ast_open() */
+    sqlite3_int64 tStart;        /* parse started */
+    sqlite3_int64 tCapture;      /* capture hook entered, or 0 */
+    sqlite3_int64 tCaptured;     /* capture hook done serializing */
+    sqlite3_int64 tEnd;          /* last sqlite3_prepare_v2() returned */
+    sqlite3_int64 nsParse;       /* phases, summed over the statements */
+    sqlite3_int64 nsSerialize;
+    sqlite3_int64 nsFinish;
+    size_t nOut;                 /* bytes of output */
+    sqlite3_int64 nMemStart;     /* SQLITE_STATUS_MEMORY_USED before */
+    sqlite3_int64 nMemHighwater; /* ... and its high-water mark during */
+    sqlite3_int64 nAllocHighwater;  /* SQLITE_STATUS_MALLOC_COUNT */
+    sqlite3_int64 nLargestAlloc;    /* SQLITE_STATUS_MALLOC_SIZE */
+    int nLookasideUsed;          /* SQLITE_DBSTATUS_LOOKASIDE_USED high-water */
+    int nLookasideHit;
+    int nLookasideMissSize;
+    int nLookasideMissFull;
+};
+
+static sqlite3_int64 ast_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The counting emitter (p is the AstStats) */
+static void st_obj_start(void *p) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xObjStart(s->pEmitArg);
+}
+
+static void st_obj_end(void *p) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xObjEnd(s->pEmitArg);
+}
+
+static void st_arr_start(void *p) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xArrStart(s->pEmitArg);
+}
+
+static void st_arr_end(void *p) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xArrEnd(s->pEmitArg);
+}
+
+static void st_key(void *p, int eKey) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = eKey == AST_KEY_type;
+    s->pEmit->xKey(s->pEmitArg, eKey);
+}
+
+static void st_sym(void *p, int eSym) {
+    AstStats *s = (AstStats *)p;
+    if (s->afterType) s->aNode[eSym]++;
+    s->afterType = 0;
+    s->pEmit->xSym(s->pEmitArg, eSym);
+}
+
+static void st_str(void *p, const char *z) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xStr(s->pEmitArg, z);
+}
+
+static void st_int(void *p, int v) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xInt(s->pEmitArg, v);
+}
+
+static void st_bool(void *p, int v) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xBool(s->pEmitArg, v);
+}
+
+static void st_null(void *p) {
+    AstStats *s = (AstStats *)p;
+    s->afterType = 0;
+    s->pEmit->xNull(s->pEmitArg);
+}
+
+static const AstEmitter st_emitter = {
+    st_obj_start, st_obj_end, st_arr_start, st_arr_end,
+    st_key, st_sym, st_str, st_int, st_bool, st_null,
+};
+
+/* Reset the counters and put the counting emitter in front of c's */
+static void stats_begin(AstCtx *c, sqlite3 *db) {
+    AstStats *s = c->pStats;
+    sqlite3_int64 hw;
+    int cur;
+
+    s->pEmit = c->pEmit;
+    s->pEmitArg = c->pEmitArg;
+    s->afterType = 0;
+    memset(s->aNode, 0, sizeof(s->aNode));
+    s->nsParse = s->nsSerialize = s->nsFinish = 0;
+    s->nOut = 0;
+    c->pEmit = &st_emitter;
+    c->pEmitArg = s;
+
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &s->nMemStart, &hw, 1);
+    sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &hw, &hw, 1);
+    sqlite3_status64(SQLITE_STATUS_MALLOC_SIZE, &hw, &hw, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &cur, &cur, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &cur, &cur, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &cur, &cur, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &cur, &cur, 1);
+    s->tStart = s->tEnd = ast_now_ns();
+}
+
+/* Record the state at the end of the parse and restore c's emitter */
+static void stats_end(AstCtx *c, sqlite3 *db) {
+    AstStats *s = c->pStats;
+    sqlite3_int64 cur;
+    int icur;
+
+    c->pEmit = s->pEmit;
+    c->pEmitArg = s->pEmitArg;
+
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &cur, &s->nMemHighwater, 0);
+    sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &cur, &s->nAllocHighwater, 0);
+    sqlite3_status64(SQLITE_STATUS_MALLOC_SIZE, &cur, &s->nLargestAlloc, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED,
+                      &icur, &s->nLookasideUsed, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT,
+                      &icur, &s->nLookasideHit, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE,
+                      &icur, &s->nLookasideMissSize, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL,
+                      &icur, &s->nLookasideMissFull, 0);
+}
+
+static void stats_key_int(JsonWriter *w, const char *zKey, sqlite3_int64 v) {
+    char zNum[24];
+    int n = snprintf(zNum, sizeof(zNum), "%lld", (long long)v);
+    jw_key_n(w, zKey, strlen(zKey));
+    jw_value_raw(w, zNum, (size_t)n);
+}
+
+/* Write the statistics of the last parse to w as one JSON object */
+static void stats_write(JsonWriter *w, const AstStats *s) {
+    sqlite3_int64 nNode = 0;
+
+    jw_obj_start(w);
+    stats_key_int(w, "open_ns", s->nsOpen);
+    stats_key_int(w, "parse_ns", s->nsParse);
+    stats_key_int(w, "serialize_ns", s->nsSerialize);
+    stats_key_int(w, "finish_ns", s->nsFinish);
+    stats_key_int(w, "total_ns", s->tEnd - s->tStart);
+    stats_key_int(w, "output_bytes", (sqlite3_int64)s->nOut);
+    for (int i = 0; i < AST_SYM_COUNT; i++) nNode += s->aNode[i];
+    stats_key_int(w, "nodes", nNode);
+    jw_key_n(w, "node_types", 10);
+    jw_obj_start(w);
+    for (int i = 0; i < AST_SYM_COUNT; i++) {
+        if (s->aNode[i]) stats_key_int(w, ast_sym_names[i].z, s->aNode[i]);
+    }
+    jw_obj_end(w);
+    jw_key_n(w, "memory", 6);
+    if (sqlite3GlobalConfig.bMemstat) {
+        jw_obj_start(w);
+        stats_key_int(w, "used_at_start", s->nMemStart);
+        stats_key_int(w, "used_highwater", s->nMemHighwater);
+        stats_key_int(w, "allocations_highwater", s->nAllocHighwater);
+        stats_key_int(w, "largest_allocation", s->nLargestAlloc);
+        jw_obj_end(w);
+    } else {
+        jw_null(w);
+    }
+    jw_key_n(w, "lookaside", 9);
+    jw_obj_start(w);
+    stats_key_int(w, "used_highwater", s->nLookasideUsed);
+    stats_key_int(w, "hit", s->nLookasideHit);
+    stats_key_int(w, "miss_size", s->nLookasideMissSize);
+    stats_key_int(w, "miss_full", s->nLookasideMissFull);
+    jw_obj_end(w);
+    jw_obj_end(w);
+}
+
+/* ================================================================
+ * Fingerprints (sqlite_ast_fingerprint())
+ *
+ * A fingerprint identifies a statement's shape: statements that differ
+ * only in their literals and parameters share one. The hash is taken by
+ * an emitter, so it sees the same events as the JSON writer but builds
+ * nothing. Each literal's object (integer, float, string, blob or
+ * parameter) is hashed as if it were {"type": "?"}, and every event is
+ * fed to 64-bit FNV-1a as bytes:
+ *
+ *   '{' '}' '[' ']'           object and array start and end
+ *   'k' name 0                a key
+ *   's' text 0                a string or symbol
+ *   'i' decimal 0             an integer
+ *   't' 'f' 'n'               true, false, null
+ *
+ * so the hash is a function of the JSON tree alone, and can be computed
+ * again from it. The normalized text comes from SQLite's tokenizer, with
+ * each literal replaced by "?", keywords upper-cased, comments dropped
+ * and a single space between tokens except around "(", ")", "," and ".".
+ * ================================================================ */
+
+#define FP_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FP_PRIME        0x100000001b3ULL
+
+typedef struct AstFingerprint {
+    uint64_t h;
+    int afterType;    /* the last event was the "type" key */
+    int inLiteral;    /* inside a literal's object, which is not hashed */
+} AstFingerprint;
+
+static uint64_t fnv_byte(uint64_t h, unsigned char c) {
+    return (h ^ c) * FP_PRIME;
+}
+
+/* Hash tag, then the NUL-terminated text z including its terminator */
+static uint64_t fnv_text(uint64_t h, unsigned char tag, const char *z) {
+    const unsigned char *p = (const unsigned char *)(z ? z : "");
+    h = (h ^ tag) * FP_PRIME;
+    do {
+        h = (h ^ *p) * FP_PRIME;
+    } while (*p++);
+    return h;
+}
+
+/* Hash an integer event */
+static uint64_t fnv_int(uint64_t h, int v) {
+    char zNum[12];
+    snprintf(zNum, sizeof(zNum), "%d", v);
+    return fnv_text(h, 'i', zNum);
+}
+
+static void fp_byte(AstFingerprint *f, unsigned char c) {
+    f->h = fnv_byte(f->h, c);
+}
+
+static void fp_text(AstFingerprint *f, unsigned char tag, const char *z) {
+    f->h = fnv_text(f->h, tag, z);
+}
+
+/* The hashing emitter (p is the AstFingerprint) */
+static void fp_obj_start(void *p) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    f->afterType = 0;
+    fp_byte(f, '{');
+}
+
+static void fp_obj_end(void *p) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    f->afterType = 0;
+    f->inLiteral = 0;
+    fp_byte(f, '}');
+}
+
+static void fp_arr_start(void *p) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    f->afterType = 0;
+    fp_byte(f, '[');
+}
+
+static void fp_arr_end(void *p) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    f->afterType = 0;
+    fp_byte(f, ']');
+}
+
+static void fp_key(void *p, int eKey) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    f->afterType = eKey == AST_KEY_type;
+    fp_text(f, 'k', ast_key_names[eKey].z);
+}
+
+static void fp_sym(void *p, int eSym) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    if (f->afterType) {
+        switch (eSym) {
+            case AST_SYM_INTEGER:
+            case AST_SYM_FLOAT:
+            case AST_SYM_STRING:
+            case AST_SYM_BLOB:
+            case AST_SYM_PARAMETER:
+                f->afterType = 0;
+                f->inLiteral = 1;
+                fp_text(f, 's', "?");
+                return;
+        }
+    }
+    f->afterType = 0;
+    fp_text(f, 's', ast_sym_names[eSym].z);
+}
+
+static void fp_str(void *p, const char *z) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    f->afterType = 0;
+    fp_text(f, 's', z);
+}
+
+static void fp_int(void *p, int v) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    f->afterType = 0;
+    f->h = fnv_int(f->h, v);
+}
+
+static void fp_bool(void *p, int v) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    f->afterType = 0;
+    fp_byte(f, v ? 't' : 'f');
+}
+
+static void fp_null(void *p) {
+    AstFingerprint *f = (AstFingerprint *)p;
+    if (f->inLiteral) return;
+    f->afterType = 0;
+    fp_byte(f, 'n');
+}
+
+static const AstEmitter fp_emitter = {
+    fp_obj_start, fp_obj_end, fp_arr_start, fp_arr_end,
+    fp_key, fp_sym, fp_str, fp_int, fp_bool, fp_null,
+};
+
+/*
+** Many keywords (KEY, REPLACE, FIRST, ROWS, ...) fall back to being an
+** identifier wherever the grammar has no use for them as a keyword, so
+** a token's type alone cannot tell "SELECT key FROM t" from "ORDER BY a
+** DESC". FpRecognizer follows the tokens through SQLite's own parser
+** tables, without running any grammar actions, to find out which tokens
+** the parser takes as identifiers. If the tables cannot be followed
+** (out of memory, or a token the parser would reject), recognition stops
+** and tokens are taken by their type.
+*/
+typedef struct FpRecognizer {
+    YYACTIONTYPE *aState;  /* the parser's stack of states */
+    int nState;
+    int nAlloc;
+    int ok;                /* still following the parser */
+} FpRecognizer;
+
+static void fp_push(FpRecognizer *r, int iState) {
+    if (r->nState == r->nAlloc) {
+        int nAlloc = r->nAlloc ? r->nAlloc * 2 : 64;
+        YYACTIONTYPE *a = realloc(r->aState, nAlloc * sizeof(*a));
+        if (a == NULL) {
+            r->ok = 0;
+            return;
+        }
+        r->aState = a;
+        r->nAlloc = nAlloc;
+    }
+    r->aState[r->nState++] = (YYACTIONTYPE)iState;
+}
+
+/* True if the parser's state iState has an action of its own for eType */
+static int fp_has_action(int iState, int eType) {
+    return yy_lookahead[yy_shift_ofst[iState] + eType] == eType;
+}
+
+/*
+** Pass token eType to the recognizer as sqlite3Parser() would. Returns
+** TK_ID if the parser shifts it as an identifier, or else eType.
+*/
+static int fp_recognize(FpRecognizer *r, int eType) {
+    while (r->ok) {
+        int iState = r->aState[r->nState - 1];
+        int iAct = yy_find_shift_action((YYCODETYPE)eType, (YYACTIONTYPE)iState);
+        if (iAct >= YY_MIN_REDUCE && iAct <= YY_MAX_REDUCE) {
+            int iRule = iAct - YY_MIN_REDUCE;
+            r->nState += yyRuleInfoNRhs[iRule];
+            if (r->nState < 1) break;
+            iAct = yy_find_reduce_action(r->aState[r->nState - 1],
+                                         yyRuleInfoLhs[iRule]);
+            fp_push(r, iAct);
+        } else if (iAct <= YY_MAX_SHIFTREDUCE) {
+            int isId = eType == TK_ID
+                || (iState <= YY_MAX_SHIFT && !fp_has_action(iState, eType)
+                    && yyFallback[eType] == TK_ID && fp_has_action(iState, TK_ID));
+            if (iAct > YY_MAX_SHIFT) iAct += YY_MIN_REDUCE - YY_MIN_SHIFTREDUCE;
+            fp_push(r, iAct);
+            return isId ? TK_ID : eType;
+        } else {
+            break;
+        }
+    }
+    r->ok = 0;
+    return eType;
+}
+
+/*
+** Write the normalized text of the first statement of the NUL-terminated
+** zSql to w. Tokens are copied up to the first semicolon, which cannot
+** appear in a SELECT outside a literal. Keywords are upper-cased and
+** identifiers, including keywords the parser takes as identifiers, are
+** kept as written.
+*/
+static void fp_shape(JsonWriter *w, const char *zSql) {
+    const unsigned char *z = (const unsigned char *)zSql;
+    FpRecognizer r = { NULL, 0, 0, 1 };
+    int eLast = 0;       /* type the last token was passed to the parser as */
+    int prev = 0;        /* type of the last token written, 0 at start */
+    char cPrev = 0;      /* its first byte */
+
+    fp_push(&r, 0);
+    while (*z) {
+        int eType;
+        int n = (int)sqlite3GetToken(z, &eType);
+        if (n <= 0) break;
+        if (eType == TK_SPACE || eType == TK_COMMENT) {
+            z += n;
+            continue;
+        }
+        if (eType == TK_SEMI) break;
+
+        /* As sqlite3RunParser() decides whether these are keywords */
+#ifndef SQLITE_OMIT_WINDOWFUNC
+        if (eType == TK_WINDOW) {
+            eType = analyzeWindowKeyword(z + n);
+        } else if (eType == TK_OVER) {
+            eType = analyzeOverKeyword(z + n, eLast);
+        } else if (eType == TK_FILTER) {
+            eType = analyzeFilterKeyword(z + n, eLast);
+        }
+#endif
+        eLast = eType;
+        eType = fp_recognize(&r, eType);
+
+        int isLiteral = eType == TK_INTEGER || eType == TK_FLOAT
+                     || eType == TK_STRING || eType == TK_BLOB
+                     || eType == TK_VARIABLE
+#ifdef TK_QNUMBER
+                     || eType == TK_QNUMBER
+#endif
+                     ;
+        char c = isLiteral ? '?' : (char)z[0];
+        /* No space inside parentheses, before "," or around "." */
+        if (prev != 0 && cPrev != '(' && cPrev != '.'
+            && c != ')' && c != ',' && c != '.'
+            && !(eType == TK_LP && prev == TK_ID)) {
+            JW_LIT(w, " ");
+        }
+        if (isLiteral) {
+            JW_LIT(w, "?");
+        } else if (eType != TK_ID
+                   && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+            /* A keyword */
+            if (jw_reserve(w, (size_t)n)) {
+                for (int i = 0; i < n; i++) {
+                    char k = (char)z[i];
+                    if (k >= 'a' && k <= 'z') k = (char)(k - 'a' + 'A');
+                    w->buf[w->pos++] = k;
+                }
+            }
+        } else {
+            jw_raw_n(w, (const char *)z, (size_t)n);
+        }
+        prev = eType;
+        cPrev = c;
+        z += n;
+    }
+    free(r.aState);
+}
+
+/* ================================================================
+ * Subtree Hashes (SQLITE_AST_SUBTREES)
+ *
+ * A handle opened with SQLITE_AST_SUBTREES gives every node of the tree
+ * a structural hash, computed bottom-up by an emitter placed in front of
+ * the real one, so that repeated subqueries, predicates and so on can be
+ * found across a corpus. The hash is a Merkle hash: an object is hashed
+ * with the fingerprint encoding above, except that each object nested in
+ * it (directly or within an array) is hashed as 'h' followed by its own
+ * hash in 8 little-endian bytes, and nothing is replaced by "?". Equal
+ * subtrees therefore have equal hashes wherever they appear, and each
+ * hash is finished as soon as its object ends.
+ * ================================================================ */
+
+/* An object being hashed */
+typedef struct AstSubtreeFrame {
+    uint64_t h;
+    int eType;     /* AST_SYM_* of its "type", or -1 if it is not a node */
+    int nNode;     /* nodes below it so far */
+} AstSubtreeFrame;
+
+struct AstSubtrees {
+    const AstEmitter *pEmit;     /* the emitter being fed */
+    void *pEmitArg;
+    int afterType;               /* the last event was the "type" key */
+    AstSubtreeFrame *aFrame;     /* open objects, innermost last */
+    int nFrame;
+    int nFrameAlloc;
+    sqlite_ast_subtree *aSub;    /* finished nodes, children first */
+    int nSub;
+    int nSubAlloc;
+    int oom;
+};
+
+/* Feed bytes to the innermost open object, if any */
+#define sub_top(s) ((s)->nFrame ? &(s)->aFrame[(s)->nFrame - 1] : NULL)
+
+static void sub_byte(AstSubtrees *s, unsigned char c) {
+    AstSubtreeFrame *f = sub_top(s);
+    if (f) f->h = fnv_byte(f->h, c);
+}
+
+static void sub_text(AstSubtrees *s, unsigned char tag, const char *z) {
+    AstSubtreeFrame *f = sub_top(s);
+    if (f) f->h = fnv_text(f->h, tag, z);
+}
+
+static void sub_obj_start(void *p) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    if (s->nFrame == s->nFrameAlloc) {
+        int nAlloc = s->nFrameAlloc ? s->nFrameAlloc * 2 : 64;
+        AstSubtreeFrame *a = realloc(s->aFrame, nAlloc * sizeof(*a));
+        if (a == NULL) s->oom = 1;
+        else {
+            s->aFrame = a;
+            s->nFrameAlloc = nAlloc;
+        }
+    }
+    if (!s->oom) {
+        AstSubtreeFrame *f = &s->aFrame[s->nFrame++];
+        f->h = fnv_byte(FP_OFFSET_BASIS, '{');
+        f->eType = -1;
+        f->nNode = 0;
+    }
+    s->pEmit->xObjStart(s->pEmitArg);
+}
+
+static void sub_obj_end(void *p) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    if (!s->oom && s->nFrame > 0) {
+        AstSubtreeFrame f = s->aFrame[--s->nFrame];
+        AstSubtreeFrame *pParent = sub_top(s);
+        f.h = fnv_byte(f.h, '}');
+        if (f.eType >= 0) {
+            if (s->nSub == s->nSubAlloc) {
+                int nAlloc = s->nSubAlloc ? s->nSubAlloc * 2 : 64;
+                sqlite_ast_subtree *a = realloc(s->aSub, nAlloc * sizeof(*a));
+                if (a == NULL) s->oom = 1;
+                else {
+                    s->aSub = a;
+                    s->nSubAlloc = nAlloc;
+                }
+            }
+            if (!s->oom) {
+                sqlite_ast_subtree *pSub = &s->aSub[s->nSub++];
+                pSub->hash = f.h;
+                pSub->zType = ast_sym_names[f.eType].z;
+                pSub->nNode = f.nNode + 1;
+            }
+            f.nNode++;
+        }
+        if (pParent) {
+            pParent->h = fnv_byte(pParent->h, 'h');
+            for (int i = 0; i < 8; i++) {
+                pParent->h = fnv_byte(pParent->h, (unsigned char)(f.h >> (8 * i)));
+            }
+            pParent->nNode += f.nNode;
+        }
+    }
+    s->pEmit->xObjEnd(s->pEmitArg);
+}
+
+static void sub_arr_start(void *p) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    sub_byte(s, '[');
+    s->pEmit->xArrStart(s->pEmitArg);
+}
+
+static void sub_arr_end(void *p) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    sub_byte(s, ']');
+    s->pEmit->xArrEnd(s->pEmitArg);
+}
+
+static void sub_key(void *p, int eKey) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = eKey == AST_KEY_type;
+    sub_text(s, 'k', ast_key_names[eKey].z);
+    s->pEmit->xKey(s->pEmitArg, eKey);
+}
+
+static void sub_sym(void *p, int eSym) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    AstSubtreeFrame *f = sub_top(s);
+    if (s->afterType && f) f->eType = eSym;
+    s->afterType = 0;
+    sub_text(s, 's', ast_sym_names[eSym].z);
+    s->pEmit->xSym(s->pEmitArg, eSym);
+}
+
+static void sub_str(void *p, const char *z) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    sub_text(s, 's', z);
+    s->pEmit->xStr(s->pEmitArg, z);
+}
+
+static void sub_int(void *p, int v) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    AstSubtreeFrame *f = sub_top(s);
+    s->afterType = 0;
+    if (f) f->h = fnv_int(f->h, v);
+    s->pEmit->xInt(s->pEmitArg, v);
+}
+
+static void sub_bool(void *p, int v) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    sub_byte(s, v ? 't' : 'f');
+    s->pEmit->xBool(s->pEmitArg, v);
+}
+
+static void sub_null(void *p) {
+    AstSubtrees *s = (AstSubtrees *)p;
+    s->afterType = 0;
+    sub_byte(s, 'n');
+    s->pEmit->xNull(s->pEmitArg);
+}
+
+static const AstEmitter sub_emitter = {
+    sub_obj_start, sub_obj_end, sub_arr_start, sub_arr_end,
+    sub_key, sub_sym, sub_str, sub_int, sub_bool, sub_null,
+};
+
+/* Clear the table and put the hashing emitter in front of c's */
+static void subtrees_begin(AstCtx *c) {
+    AstSubtrees *s = c->pSubtrees;
+    s->pEmit = c->pEmit;
+    s->pEmitArg = c->pEmitArg;
+    s->afterType = 0;
+    s->nFrame = 0;
+    s->nSub = 0;
+    s->oom = 0;
+    c->pEmit = &sub_emitter;
+    c->pEmitArg = s;
+}
+
+/* Restore c's emitter */
+static void subtrees_end(AstCtx *c) {
+    c->pEmit = c->pSubtrees->pEmit;
+    c->pEmitArg = c->pSubtrees->pEmitArg;
+}
+
+/* ================================================================
+ * Statement Splitting (sqlite_ast_split())
+ *
+ * Statement boundaries are found with SQLite's tokenizer alone, which is
+ * far cheaper than parsing. A statement ends at the first semicolon token
+ * that sqlite3_complete() would accept: its state machine is repeated
+ * here over the tokens sqlite3GetToken() returns, so semicolons inside
+ * literals and comments never count and those inside a CREATE TRIGGER
+ * body only count after its END.
+ * ================================================================ */
+
+/* Token classes of sqlite3_complete() */
+#define SPLIT_SEMI     0
+#define SPLIT_WS       1
+#define SPLIT_OTHER    2
+#define SPLIT_EXPLAIN  3
+#define SPLIT_CREATE   4
+#define SPLIT_TEMP     5
+#define SPLIT_TRIGGER  6
+#define SPLIT_END      7
+
+/*
+** Next state for each state and token class, as in sqlite3_complete().
+** States: 0 start, 1 after a statement's final semicolon, 2 in a
+** statement, 3 after EXPLAIN, 4 after CREATE [TEMP], 5 in a trigger body,
+** 6 after a semicolon in a trigger body, 7 after ";END" in one.
+*/
+static const unsigned char split_trans[8][8] = {
+    /*          SEMI  WS  OTHER  EXPLAIN  CREATE  TEMP  TRIGGER  END */
+    /* 0 */  {     1,  0,     2,       3,      4,    2,       2,   2 },
+    /* 1 */  {     1,  1,     2,       3,      4,    2,       2,   2 },
+    /* 2 */  {     1,  2,     2,       2,      2,    2,       2,   2 },
+    /* 3 */  {     1,  3,     3,       2,      4,    2,       2,   2 },
+    /* 4 */  {     1,  4,     2,       2,      2,    4,       5,   2 },
+    /* 5 */  {     6,  5,     5,       5,      5,    5,       5,   5 },
+    /* 6 */  {     6,  6,     5,       5,      5,    5,       5,   7 },
+    /* 7 */  {     1,  7,     5,       5,      5,    5,       5,   5 },
+};
+
+static int split_class(int eType) {
+    switch (eType) {
+        case TK_SEMI:    return SPLIT_SEMI;
+        case TK_SPACE:
+        case TK_COMMENT: return SPLIT_WS;
+        case TK_EXPLAIN: return SPLIT_EXPLAIN;
+        case TK_CREATE:  return SPLIT_CREATE;
+        case TK_TEMP:    return SPLIT_TEMP;
+        case TK_TRIGGER: return SPLIT_TRIGGER;
+        case TK_END:     return SPLIT_END;
+        default:         return SPLIT_OTHER;
+    }
+}
+
+/* Length of the token at z[i], which is before z[n], and its class */
+static size_t split_token(const unsigned char *z, size_t i, size_t n, int *peClass) {
+    int eType = TK_ILLEGAL;
+    i64 nToken = z[i] ? sqlite3GetToken(z + i, &eType) : 0;
+    if (nToken <= 0) nToken = 1;  /* an embedded NUL */
+    if ((size_t)nToken > n - i) nToken = (i64)(n - i);
+    *peClass = split_class(eType);
+    return (size_t)nToken;
+}
+
+/* Skip blank space, comments and empty statements from z[i] */
+static size_t split_skip(const unsigned char *z, size_t i, size_t n) {
+    while (i < n) {
+        int eClass;
+        size_t nToken = split_token(z, i, n, &eClass);
+        if (eClass != SPLIT_SEMI && eClass != SPLIT_WS) break;
+        i += nToken;
+    }
+    return i;
+}
+
+/* ================================================================
+ * Hook Function - Called from patched grammar action
+ * ================================================================ */
+
+/* Default capture action: serialize the tree to the context's emitter */
+static void capture_select(AstCtx *c, Select *p) {
+    serialize_select(c, p);
+}
+
+static void ast_capture_hook(void *parse_ptr, void *select_ptr) {
+    Parse *pParse = (Parse *)parse_ptr;
+    AstCtx *c = sqlite3_get_clientdata(pParse->db, AST_CLIENTDATA);
+    if (c == NULL || !c->captureEnabled) return;
+    if (c->captured) return;  /* Only capture the first SELECT (the user's query) */
+    c->captured = 1;
+    if (c->pStats) c->pStats->tCapture = ast_now_ns();
+    c->xCapture(c, (Select *)select_ptr);
+    if (c->pStats) c->pStats->tCaptured = ast_now_ns();
+
+    /*
+    ** The parse tree is all we need, so abandon the rest of the compile.
+    ** With nErr set, the sqlite3Select() call that follows in the grammar
+    ** action returns immediately and sqlite3FinishCoding() generates no
+    ** code. SQLITE_DONE is what sqlite3RunParser() sees after any complete
+    ** statement, so it stops reading tokens and prepare reports success.
+    ** An error already recorded by the parser (e.g. too many compound
+    ** terms) is left in place.
+    */
+    if (pParse->rc == SQLITE_OK) pParse->rc = SQLITE_DONE;
+    pParse->nErr++;
+}
+
+/* ================================================================
+ * Public API (see sqlite_ast.h)
+ * ================================================================ */
+
+/*
+** Lookaside memory for each handle's connection. SQLite's lookaside
+** allocator serves small allocations from fixed-size slots in one block
+** owned by the connection, and a freed slot goes straight back on the
+** connection's free list. A statement's parse tree is released when the
+** compile is abandoned, so with enough slots the next statement is built
+** in the same memory without calling malloc() at all.
+**
+** SQLite's default of 40 slots of 1200 bytes is sized for prepared
+** statements, and the Expr and ExprList nodes of a mid-sized query
+** overflow it. 256 slots (300KB per handle, carved by SQLite into large
+** and small slots) hold the tree of all but the largest statements;
+** beyond that, allocations fall back to malloc() as before.
+*/
+#ifndef AST_LOOKASIDE_SIZE
+#define AST_LOOKASIDE_SIZE 1200
+#endif
+#ifndef AST_LOOKASIDE_COUNT
+#define AST_LOOKASIDE_COUNT 256
+#endif
+
+struct sqlite_ast {
+    sqlite3 *db;          /* private in-memory connection */
+    int flags;            /* SQLITE_AST_* flags given to sqlite_ast_open() */
+    JsonWriter jw;        /* output; the buffer is reused across parses */
+    AstCtx ctx;           /* registered as client data on db */
+    AstStats stats;       /* with SQLITE_AST_STATS, the last parse's */
+    AstSubtrees subtrees; /* with SQLITE_AST_SUBTREES, the last parse's */
+    JsonWriter statsJw;   /* text returned by sqlite_ast_stats() */
+    JsonWriter fpJw;      /* shape returned by sqlite_ast_fingerprint() */
+    char zErrMsg[1024];   /* message for the most recent failure */
+};
+
+/*
+** Run the first statement of zSql through the parser, sending its tree
+** (if it is a SELECT) to h->ctx's emitter. If pzTail is not NULL it is
+** set to the end of the statement, or to NULL if it did not parse.
+** Returns SQLITE_AST_OK if a tree was captured, or SQLITE_AST_ERROR with
+** a message in h->zErrMsg.
+*/
+static int ast_prepare(sqlite_ast *h, const char *zSql, int nSql,
+                       const char **pzTail) {
+    AstStats *s = h->ctx.pStats;
+    sqlite3_stmt *stmt = NULL;
+    int rc;
+
+    /* Enable AST capture */
+    h->ctx.captureEnabled = 1;
+    h->ctx.captured = 0;
+    if (s) s->tCapture = 0;
+
+    /*
+    ** Call prepare to trigger the parser. The patched grammar action will
+    ** call ast_capture_hook() with the raw Select* before any resolution,
+    ** and the hook stops compilation there, so tables never need to exist.
+    */
+    rc = sqlite3_prepare_v2(h->db, zSql, nSql, &stmt, pzTail);
+    h->ctx.captureEnabled = 0;
+    if (stmt) sqlite3_finalize(stmt);
+    if (s) {
+        /*
+        ** The phases run on from the end of the previous statement, so
+        ** they add up to total_ns however many statements there are.
+        */
+        sqlite3_int64 tEnd = ast_now_ns();
+        sqlite3_int64 tCapture = s->tCapture ? s->tCapture : tEnd;
+        sqlite3_int64 tCaptured = s->tCapture ? s->tCaptured : tEnd;
+        s->nsParse += tCapture - s->tEnd;
+        s->nsSerialize += tCaptured - tCapture;
+        s->nsFinish += tEnd - tCaptured;
+        s->tEnd = tEnd;
+    }
+    if (rc != SQLITE_OK && !h->ctx.captured && pzTail) *pzTail = NULL;
+
+    if (!h->ctx.captured) {
+        /* No AST was captured - probably a parse error */
+        if (rc != SQLITE_OK) {
+            snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Parse error: %s",
+                     sqlite3_errmsg(h->db));
+        } else {
+            snprintf(h->zErrMsg, sizeof(h->zErrMsg),
+                     "No SELECT statement found in input");
+        }
+        return SQLITE_AST_ERROR;
+    }
+    return SQLITE_AST_OK;
+}
+
+/* Put the statistics and hashing emitters in front of h->ctx's */
+static void ast_begin(sqlite_ast *h) {
+    h->ctx.oom = 0;
+    h->zErrMsg[0] = 0;
+    if (h->ctx.pSubtrees) subtrees_begin(&h->ctx);
+    if (h->ctx.pStats) stats_begin(&h->ctx, h->db);
+}
+
+/* Undo ast_begin(), and check for failures that rc does not report yet */
+static int ast_end(sqlite_ast *h, int rc) {
+    if (h->ctx.pStats) stats_end(&h->ctx, h->db);
+    if (h->ctx.pSubtrees) subtrees_end(&h->ctx);
+
+    if (rc == SQLITE_AST_OK && h->ctx.oom) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory serializing AST");
+        rc = SQLITE_AST_NOMEM;
+    }
+    if (rc == SQLITE_AST_OK && h->ctx.pSubtrees && h->ctx.pSubtrees->oom) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory hashing subtrees");
+        rc = SQLITE_AST_NOMEM;
+    }
+    if (rc != SQLITE_AST_OK && h->ctx.pSubtrees) h->ctx.pSubtrees->nSub = 0;
+    return rc;
+}
+
+/*
+** Parse one SQL string, sending the tree to h->ctx's emitter, which the
+** caller has set up. Returns SQLITE_AST_OK, or SQLITE_AST_ERROR or
+** SQLITE_AST_NOMEM with a message in h->zErrMsg.
+*/
+static int ast_parse(sqlite_ast *h, const char *zSql, int nSql) {
+    ast_begin(h);
+    return ast_end(h, ast_prepare(h, zSql, nSql, NULL));
+}
+
+/* Capture action of ast_parse_all(): the tree is the record's "ast" */
+static void capture_record(AstCtx *c, Select *p) {
+    em_key(c, ast);
+    serialize_select(c, p);
+}
+
+/*
+** Parse every statement of zSql (SQLITE_AST_ALL), sending an array with
+** one record per statement to h->ctx's emitter: {"offset": N, "ast":
+** {...}} or {"offset": N, "error": "..."}, where offset is the byte
+** offset of the statement in zSql. Failing statements do not fail the
+** call. Statements are found the way SQLite finds them, by passing the
+** rest of the text to sqlite3_prepare_v2() and carrying on from the tail
+** it returns. That text must be NUL-terminated, since SQLite copies text
+** whose length is given and every statement would copy the rest of the
+** script, so with nSql >= 0 the script is copied once up front. After a
+** syntax error the tail is not a statement boundary, and the splitter
+** finds the next one.
+*/
+static int ast_parse_all(sqlite_ast *h, const char *zSql, int nSql) {
+    size_t n = nSql < 0 ? strlen(zSql) : (size_t)nSql;
+    char *zCopy = NULL;
+    const unsigned char *z;
+    size_t i = 0;
+    AstCtx *c = &h->ctx;
+    void (*xCapture)(AstCtx *, Select *) = c->xCapture;
+
+    if (n > INT_MAX) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "SQL text too long");
+        return SQLITE_AST_ERROR;
+    }
+    if (nSql >= 0) {
+        zCopy = malloc(n + 1);
+        if (zCopy == NULL) {
+            snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory");
+            return SQLITE_AST_NOMEM;
+        }
+        memcpy(zCopy, zSql, n);
+        zCopy[n] = 0;
+        zSql = zCopy;
+    }
+    z = (const unsigned char *)zSql;
+
+    ast_begin(h);
+    c->xCapture = capture_record;
+    em_arr_start(c);
+    while ((i = split_skip(z, i, n)) < n && !c->oom) {
+        const char *zTail;
+        size_t iNext;
+
+        em_obj_start(c);
+        em_key(c, offset);
+        em_int(c, (int)i);
+        if (ast_prepare(h, zSql + i, -1, &zTail) != SQLITE_AST_OK) {
+            em_key(c, error);
+            em_str(c, h->zErrMsg);
+        }
+        em_obj_end(c);
+
+        iNext = zTail ? (size_t)(zTail - zSql) : i;
+        if (iNext <= i) {
+            size_t iStart;
+            iNext = i + sqlite_ast_split(zSql + i, n - i, &iStart);
+        }
+        i = iNext;
+    }
+    em_arr_end(c);
+    c->xCapture = xCapture;
+    free(zCopy);
+    h->zErrMsg[0] = 0;
+    return ast_end(h, SQLITE_AST_OK);
+}
+
+/* Serialize zSql as JSON through h->jw, set up for output by the caller */
+static int ast_parse_json(sqlite_ast *h, const char *zSql, int nSql) {
+    JsonWriter *w = &h->jw;
+    int rc;
+
+    w->pos = 0;
+    w->oom = 0;
+    w->writeFailed = 0;
+    w->nFlushed = 0;
+    w->compact = (h->flags & SQLITE_AST_COMPACT) != 0;
+    jw_init(w);
+    rc = (h->flags & SQLITE_AST_ALL) ? ast_parse_all(h, zSql, nSql)
+                                     : ast_parse(h, zSql, nSql);
+    h->stats.nOut = rc == SQLITE_AST_OK ? w->nFlushed + w->pos : 0;
+    if (rc == SQLITE_AST_OK && w->oom) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory writing AST");
+        rc = SQLITE_AST_NOMEM;
+    }
+    return rc;
+}
+
+int sqlite_ast_open(int flags, sqlite_ast **ppAst) {
+    sqlite3_int64 tStart = ast_now_ns();
+    pthread_once(&jw_scan_once, jw_scan_init);
+
+    sqlite_ast *h = calloc(1, sizeof(*h));
+    *ppAst = NULL;
+    if (h == NULL) return SQLITE_AST_NOMEM;
+
+    if (sqlite3_open(":memory:", &h->db) != SQLITE_OK) {
+        sqlite3_close(h->db);
+        free(h);
+        return SQLITE_AST_ERROR;
+    }
+    /* Not fatal: on failure the connection keeps the default lookaside */
+    sqlite3_db_config(h->db, SQLITE_DBCONFIG_LOOKASIDE, NULL,
+                      AST_LOOKASIDE_SIZE, AST_LOOKASIDE_COUNT);
+    h->flags = flags;
+    h->ctx.pEmit = (flags & SQLITE_AST_CBOR) ? &cb_emitter : &jw_emitter;
+    h->ctx.pEmitArg = &h->jw;
+    h->ctx.xCapture = capture_select;
+    if (sqlite3_set_clientdata(h->db, AST_CLIENTDATA, &h->ctx, NULL) != SQLITE_OK) {
+        sqlite3_close(h->db);
+        free(h);
+        return SQLITE_AST_NOMEM;
+    }
+    if (flags & SQLITE_AST_SUBTREES) h->ctx.pSubtrees = &h->subtrees;
+    if (flags & SQLITE_AST_STATS) {
+        h->ctx.pStats = &h->stats;
+        h->stats.nsOpen = ast_now_ns() - tStart;
+        h->statsJw.compact = 1;
+    }
+    *ppAst = h;
+    return SQLITE_AST_OK;
+}
+
+int sqlite_ast_parse(sqlite_ast *h, const char *zSql, int nSql,
+                     const char **pzOut, size_t *pnOut) {
+    JsonWriter *w = &h->jw;
+    int rc;
+
+    w->xWrite = NULL;
+    rc = ast_parse_json(h, zSql, nSql);
+    if (rc == SQLITE_AST_OK) {
+        JW_LIT(w, "\0");
+        if (w->oom) {
+            snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory writing AST");
+            rc = SQLITE_AST_NOMEM;
+        }
+    }
+
+    /* The length excludes the NUL terminator appended above */
+    *pzOut = rc == SQLITE_AST_OK ? w->buf : NULL;
+    if (pnOut) *pnOut = rc == SQLITE_AST_OK ? w->pos - 1 : 0;
+    return rc;
+}
+
+int sqlite_ast_parse_stream(sqlite_ast *h, const char *zSql, int nSql,
+                            sqlite_ast_write_fn xWrite, void *pArg) {
+    JsonWriter *w = &h->jw;
+    int rc;
+
+    w->xWrite = xWrite;
+    w->pWriteArg = pArg;
+    rc = ast_parse_json(h, zSql, nSql);
+    jw_flush(w);
+    if (rc == SQLITE_AST_OK && w->writeFailed) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Error writing AST");
+        rc = SQLITE_AST_WRITE;
+    }
+    w->xWrite = NULL;
+    return rc;
+}
+
+const char *sqlite_ast_errmsg(sqlite_ast *h) {
+    return h->zErrMsg;
+}
+
+const char *sqlite_ast_stats(sqlite_ast *h) {
+    JsonWriter *w = &h->statsJw;
+    if (h->ctx.pStats == NULL) return "";
+    w->pos = 0;
+    w->oom = 0;
+    jw_init(w);
+    stats_write(w, &h->stats);
+    JW_LIT(w, "\0");
+    return w->oom ? "" : w->buf;
+}
+
+int sqlite_ast_fingerprint(sqlite_ast *h, const char *zSql, int nSql,
+                           unsigned long long *piHash, const char **pzShape) {
+    AstFingerprint f = { FP_OFFSET_BASIS, 0, 0 };
+    const AstEmitter *pEmit = h->ctx.pEmit;
+    void *pEmitArg = h->ctx.pEmitArg;
+    JsonWriter *w = &h->fpJw;
+    int rc;
+
+    *piHash = 0;
+    if (pzShape) *pzShape = NULL;
+    h->ctx.pEmit = &fp_emitter;
+    h->ctx.pEmitArg = &f;
+    rc = ast_parse(h, zSql, nSql);
+    h->ctx.pEmit = pEmit;
+    h->ctx.pEmitArg = pEmitArg;
+    h->stats.nOut = 0;
+    if (rc != SQLITE_AST_OK) return rc;
+    *piHash = f.h;
+    if (pzShape == NULL) return SQLITE_AST_OK;
+
+    /*
+    ** The tokenizer needs a NUL terminator. A copy is made in the output
+    ** buffer, which is not used for fingerprints.
+    */
+    if (nSql >= 0) {
+        JsonWriter *pCopy = &h->jw;
+        pCopy->pos = 0;
+        pCopy->oom = 0;
+        jw_raw_n(pCopy, zSql, (size_t)nSql);
+        JW_LIT(pCopy, "\0");
+        if (pCopy->oom) {
+            snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory writing shape");
+            return SQLITE_AST_NOMEM;
+        }
+        zSql = pCopy->buf;
+    }
+    w->pos = 0;
+    w->oom = 0;
+    fp_shape(w, zSql);
+    JW_LIT(w, "\0");
+    if (w->oom) {
+        snprintf(h->zErrMsg, sizeof(h->zErrMsg), "Out of memory writing shape");
+        return SQLITE_AST_NOMEM;
+    }
+    *pzShape = w->buf;
+    return SQLITE_AST_OK;
+}
+
+int sqlite_ast_subtrees(sqlite_ast *h, const sqlite_ast_subtree **paSub) {
+    *paSub = h->subtrees.aSub;
+    return h->ctx.pSubtrees ? h->subtrees.nSub : 0;
+}
+
+size_t sqlite_ast_split(const char *zSql, size_t nSql, size_t *piStart) {
+    const unsigned char *z = (const unsigned char *)zSql;
+    size_t i = split_skip(z, 0, nSql);
+    int state = 0;
+
+    *piStart = i;
+    while (i < nSql) {
+        int eClass;
+        i += split_token(z, i, nSql, &eClass);
+        state = split_trans[state][eClass];
+        if (state == 1) break;
+    }
+    return i;
+}
+
+void sqlite_ast_close(sqlite_ast *h) {
+    if (h == NULL) return;
+    sqlite3_close(h->db);
+    free(h->jw.buf);
+    free(h->statsJw.buf);
+    free(h->fpJw.buf);
+    free(h->subtrees.aFrame);
+    free(h->subtrees.aSub);
+    free(h->ctx.aTask);
+    free(h);
+}
+
+/*
+** Memory statistics are compiled off (see Makefile) so that allocations
+** do not take a global mutex. Turning them on affects every connection
+** in the process and is only possible before SQLite initializes, so it
+** is left to the program rather than done by any one handle.
+*/
+int sqlite_ast_enable_memstatus(void) {
+    if (sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 1) != SQLITE_OK) {
+        return SQLITE_AST_ERROR;
+    }
+    return SQLITE_AST_OK;
+}
+
+const char *sqlite_ast_sourceid(void) {
+    return sqlite3_sourceid();
+}
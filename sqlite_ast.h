@@ -0,0 +1,205 @@
+/*
+** sqlite_ast.h - public API of libsqlite_ast
+**
+** Parses SQL SELECT statements with the official SQLite parser and returns
+** the raw (pre-resolution) AST as JSON, in the format documented in
+** README.md. Each handle owns a private in-memory SQLite connection and an
+** output buffer that are reused from one parse to the next, so a long-lived
+** handle parses with no per-statement setup cost.
+**
+**   sqlite_ast *h;
+**   const char *zJson;
+**   size_t nJson;
+**   if (sqlite_ast_open(SQLITE_AST_COMPACT, &h) == SQLITE_AST_OK) {
+**       if (sqlite_ast_parse(h, "SELECT 1", -1, &zJson, &nJson) == SQLITE_AST_OK) {
+**           fwrite(zJson, 1, nJson, stdout);
+**       } else {
+**           fprintf(stderr, "%s\n", sqlite_ast_errmsg(h));
+**       }
+**       sqlite_ast_close(h);
+**   }
+**
+** All parser and serializer state belongs to the handle, so any number of
+** threads may parse at once as long as each uses its own handle. A single
+** handle must not be used by two threads at the same time.
+*/
+#ifndef SQLITE_AST_H
+#define SQLITE_AST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define SQLITE_AST_API __attribute__((visibility("default")))
+#else
+#define SQLITE_AST_API
+#endif
+
+/* Result codes */
+#define SQLITE_AST_OK     0  /* success */
+#define SQLITE_AST_ERROR  1  /* parse error, or no SELECT in the input */
+#define SQLITE_AST_NOMEM  2  /* out of memory */
+#define SQLITE_AST_WRITE  3  /* the write callback reported an error */
+
+/*
+** Version of the AST format. It is incremented whenever the JSON produced
+** for some input changes, so that stored ASTs (such as a cache keyed on
+** this and sqlite_ast_sourceid()) can tell they are out of date.
+*/
+#define SQLITE_AST_SERIALIZER_VERSION 1
+
+/* Flags for sqlite_ast_open() */
+#define SQLITE_AST_COMPACT 0x01  /* no newlines or indentation */
+#define SQLITE_AST_STATS   0x02  /* record statistics (sqlite_ast_stats()) */
+#define SQLITE_AST_CBOR    0x04  /* output CBOR instead of JSON (see README.md) */
+#define SQLITE_AST_SUBTREES 0x08 /* hash every subtree (sqlite_ast_subtrees()) */
+#define SQLITE_AST_ALL     0x10  /* parse every statement, not just the first */
+
+typedef struct sqlite_ast sqlite_ast;
+
+/* One node of the most recent tree, as reported by sqlite_ast_subtrees() */
+typedef struct sqlite_ast_subtree {
+    unsigned long long hash;  /* hash of the node and everything below it */
+    const char *zType;        /* its "type", such as "select" or "binary" */
+    int nNode;                /* number of typed nodes in it, itself included */
+} sqlite_ast_subtree;
+
+/*
+** Output callback for sqlite_ast_parse_stream(). Called with successive
+** pieces of the output; returns 0 on success or nonzero to report an
+** error (the remaining output is then discarded).
+*/
+typedef int (*sqlite_ast_write_fn)(void *pArg, const char *z, size_t n);
+
+/*
+** Create a parse handle. On success *ppAst is set and SQLITE_AST_OK is
+** returned; otherwise *ppAst is NULL.
+*/
+SQLITE_AST_API int sqlite_ast_open(int flags, sqlite_ast **ppAst);
+
+/*
+** Parse the first statement of zSql (nSql bytes, or up to the first NUL if
+** nSql is negative), which must be a SELECT. On success *pzOut points to
+** the NUL-terminated JSON AST and *pnOut (if not NULL) holds its length.
+** With SQLITE_AST_CBOR the output is binary and may contain NULs, so use
+** *pnOut. The output is owned by the handle and stays valid until the
+** next call on it.
+**
+** With SQLITE_AST_ALL every statement of zSql is parsed, whatever its
+** kind, and the output is an array with one record per statement:
+**
+**   [{"offset":0,"ast":{...}},{"offset":10,"error":"..."},...]
+**
+** where offset is the byte offset of the statement in zSql. A statement
+** that fails only gets an error record; the call itself succeeds unless
+** memory runs out or the write callback fails. Statistics and subtree
+** hashes then cover the whole script.
+*/
+SQLITE_AST_API int sqlite_ast_parse(sqlite_ast *h, const char *zSql, int nSql,
+                                    const char **pzOut, size_t *pnOut);
+
+/*
+** Like sqlite_ast_parse(), but the output is passed to xWrite in pieces of
+** bounded size as it is produced, so a huge tree is never held in memory
+** at once. Nothing is written if the input fails to parse.
+*/
+SQLITE_AST_API int sqlite_ast_parse_stream(sqlite_ast *h, const char *zSql,
+                                           int nSql, sqlite_ast_write_fn xWrite,
+                                           void *pArg);
+
+/* Message describing the most recent failure on h ("" after success) */
+SQLITE_AST_API const char *sqlite_ast_errmsg(sqlite_ast *h);
+
+/*
+** Statistics for the most recent parse on a handle opened with
+** SQLITE_AST_STATS, as a compact JSON object (or "" for other handles):
+**
+**   {"open_ns":N,"parse_ns":N,"serialize_ns":N,"finish_ns":N,"total_ns":N,
+**    "output_bytes":N,"nodes":N,"node_types":{"select":1,"binary":2,...},
+**    "memory":{"used_at_start":N,"used_highwater":N,
+**              "allocations_highwater":N,"largest_allocation":N},
+**    "lookaside":{"used_highwater":N,"hit":N,"miss_size":N,"miss_full":N}}
+**
+** open_ns is the time sqlite_ast_open() took. parse_ns covers tokenizing
+** and parsing up to the point the SELECT is captured, serialize_ns the
+** serialization (including any calls to the write callback) and
+** finish_ns the rest of sqlite3_prepare_v2(), mostly freeing the tree.
+** "memory" holds sqlite3_status() high-water marks, which are process
+** wide; it is null unless sqlite_ast_enable_memstatus() was called.
+** "lookaside" is the handle's connection only. The text is owned by the
+** handle and stays valid until the next call on it.
+*/
+SQLITE_AST_API const char *sqlite_ast_stats(sqlite_ast *h);
+
+/*
+** Fingerprint the first statement of zSql, which must be a SELECT, so
+** that statements differing only in their literals and parameters can be
+** grouped. *piHash is set to a 64-bit hash of its AST with every literal
+** and parameter node replaced by {"type": "?"}, computed without writing
+** any JSON; the hash is stable for as long as SQLITE_AST_SERIALIZER_VERSION
+** and the SQLite version are. If pzShape is not NULL, *pzShape is set to
+** the statement's text normalized the same way ("SELECT a FROM t WHERE
+** b = ?"), owned by the handle until the next call on it.
+*/
+SQLITE_AST_API int sqlite_ast_fingerprint(sqlite_ast *h, const char *zSql,
+                                          int nSql, unsigned long long *piHash,
+                                          const char **pzShape);
+
+/*
+** Every node of the tree produced by the most recent successful parse or
+** fingerprint on a handle opened with SQLITE_AST_SUBTREES. *paSub is set
+** to an array owned by the handle, valid until the next call on it, and
+** the number of entries is returned (0 for other handles or after a
+** failure). Entries are in post-order: every node follows all of its
+** descendants and the root comes last.
+**
+** A node's hash covers its keys and values, literals included, with each
+** child node contributing its own hash (a Merkle tree), so two nodes
+** anywhere in any statements hash equal exactly when their JSON does, up
+** to 64-bit collisions. Computing them costs one pass over the tree,
+** however deep, and no extra JSON.
+*/
+SQLITE_AST_API int sqlite_ast_subtrees(sqlite_ast *h,
+                                       const sqlite_ast_subtree **paSub);
+
+/*
+** Find the first statement in the nSql bytes at zSql using SQLite's
+** tokenizer alone, without parsing it. It ends at the first semicolon
+** that sqlite3_complete() would accept, so semicolons inside literals,
+** comments and CREATE TRIGGER bodies do not end it. *piStart is set to
+** the offset of its first token, after any blank space, comments and
+** empty statements, and the offset just past its semicolon is returned
+** (nSql for a final statement without one); that is where the next
+** statement is to be looked for. If nothing but blank space and comments
+** remains, *piStart is set to nSql and nSql is returned.
+**
+** No copy is made and no handle is needed, so zSql may be a memory-mapped
+** file. The tokenizer stops at a NUL byte, so zSql must have one at or
+** after zSql[nSql]; the text is never read beyond the first one.
+*/
+SQLITE_AST_API size_t sqlite_ast_split(const char *zSql, size_t nSql,
+                                       size_t *piStart);
+
+/*
+** Turn on SQLite's process-wide memory statistics, which fill in the
+** "memory" member of sqlite_ast_stats(). They are off by default because
+** they make every allocation in the process take a global mutex. This
+** must be called before any handle is opened and while no other thread
+** is using the library; returns SQLITE_AST_ERROR if it is too late.
+*/
+SQLITE_AST_API int sqlite_ast_enable_memstatus(void);
+
+/* Release a handle. Passing NULL is a no-op. */
+SQLITE_AST_API void sqlite_ast_close(sqlite_ast *h);
+
+/* sqlite3_sourceid() of the SQLite parser built into the library */
+SQLITE_AST_API const char *sqlite_ast_sourceid(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQLITE_AST_H */
@@ -1,3 +1,15 @@
 from pathlib import Path
 
 AST_TESTS_DIR = Path(__file__).parent / "ast-tests"
+
+# The same cases packed into one indexed file (see bundle.py)
+from .bundle import AST_BUNDLE, case_names, get_case, iter_cases
+
+# The native parser is only present when built from a source checkout
+# (make python-ext); parse and parse_all are None otherwise.
+try:
+    from ._parser import ParseError, parse, parse_all
+except ImportError:
+    ParseError = None
+    parse = None
+    parse_all = None
@@ -0,0 +1,292 @@
+/*
+** _parser.c - CPython extension: parse(sql) -> dict, parse_all(sql) -> list
+**
+** Builds the same tree as dump_ast, but as Python objects created
+** directly from the captured Select* through a Python emitter, with no
+** JSON text in between. Keys and symbol values are interned strings
+** created once at import time.
+**
+** Build: make python-ext (needs the patched amalgamation, like dump_ast)
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "../sqlite_ast.c"
+
+/* ================================================================
+ * Python Emitter
+ *
+ * aStack holds the open dicts and lists (borrowed references; each is
+ * owned by its parent, the outermost by pResult). A value is attached to
+ * the innermost container as soon as it is created, using eKey when that
+ * container is a dict. After any failure every event is ignored and the
+ * partial result is discarded.
+ * ================================================================ */
+
+static PyObject *g_py_keys[AST_KEY_COUNT];
+static PyObject *g_py_syms[AST_SYM_COUNT];
+static PyObject *g_py_empty;
+static PyObject *g_parse_error;
+
+typedef struct PyBuilder {
+    PyObject **aStack;
+    int nStack;
+    int nAlloc;
+    int eKey;            /* key for the next value added to a dict */
+    PyObject *pResult;   /* the root value */
+    int failed;
+} PyBuilder;
+
+/* Attach v (a new reference, or NULL on error) to the innermost container */
+static PyObject *py_add(PyBuilder *b, PyObject *v) {
+    if (v == NULL) {
+        b->failed = 1;
+        return NULL;
+    }
+    if (b->nStack == 0) {
+        b->pResult = v;
+        return v;
+    }
+    PyObject *pParent = b->aStack[b->nStack - 1];
+    int rc = PyList_CheckExact(pParent)
+        ? PyList_Append(pParent, v)
+        : PyDict_SetItem(pParent, g_py_keys[b->eKey], v);
+    Py_DECREF(v);
+    if (rc != 0) {
+        b->failed = 1;
+        return NULL;
+    }
+    return v;
+}
+
+static void py_open(PyBuilder *b, PyObject *v) {
+    if (b->failed) {
+        Py_XDECREF(v);
+        return;
+    }
+    if (b->nStack == b->nAlloc) {
+        int nAlloc = b->nAlloc ? b->nAlloc * 2 : 64;
+        PyObject **aStack = PyMem_Realloc(b->aStack, nAlloc * sizeof(PyObject *));
+        if (aStack == NULL) {
+            Py_XDECREF(v);
+            PyErr_NoMemory();
+            b->failed = 1;
+            return;
+        }
+        b->aStack = aStack;
+        b->nAlloc = nAlloc;
+    }
+    v = py_add(b, v);
+    if (v) b->aStack[b->nStack++] = v;
+}
+
+static void py_value(PyBuilder *b, PyObject *v) {
+    if (b->failed) {
+        Py_XDECREF(v);
+        return;
+    }
+    py_add(b, v);
+}
+
+static void py_obj_start(void *p) {
+    PyBuilder *b = (PyBuilder *)p;
+    if (!b->failed) py_open(b, PyDict_New());
+}
+
+static void py_arr_start(void *p) {
+    PyBuilder *b = (PyBuilder *)p;
+    if (!b->failed) py_open(b, PyList_New(0));
+}
+
+static void py_close(void *p) {
+    PyBuilder *b = (PyBuilder *)p;
+    if (!b->failed) b->nStack--;
+}
+
+static void py_key(void *p, int eKey) {
+    ((PyBuilder *)p)->eKey = eKey;
+}
+
+static void py_sym(void *p, int eSym) {
+    Py_INCREF(g_py_syms[eSym]);
+    py_value((PyBuilder *)p, g_py_syms[eSym]);
+}
+
+static void py_str(void *p, const char *z) {
+    PyBuilder *b = (PyBuilder *)p;
+    if (z == NULL || z[0] == 0) {
+        Py_INCREF(g_py_empty);
+        py_value(b, g_py_empty);
+    } else if (!b->failed) {
+        py_value(b, PyUnicode_DecodeUTF8(z, (Py_ssize_t)strlen(z), "surrogateescape"));
+    }
+}
+
+static void py_int(void *p, int v) {
+    PyBuilder *b = (PyBuilder *)p;
+    if (!b->failed) py_value(b, PyLong_FromLong(v));
+}
+
+static void py_bool(void *p, int v) {
+    py_value((PyBuilder *)p, PyBool_FromLong(v));
+}
+
+static void py_null(void *p) {
+    Py_INCREF(Py_None);
+    py_value((PyBuilder *)p, Py_None);
+}
+
+static const AstEmitter py_emitter = {
+    py_obj_start, py_close, py_arr_start, py_close,
+    py_key, py_sym, py_str, py_int, py_bool, py_null,
+};
+
+/* ================================================================
+ * Module
+ * ================================================================ */
+
+/*
+** One handle for the module, opened at import, and set while a call is
+** using it. The GIL alone does not keep calls apart: building the dicts
+** can run the garbage collector and so any __del__ method, which may
+** call parse() again from inside the capture hook, and free-threaded
+** builds have no GIL at all. A call that finds the handle busy parses
+** with a handle of its own instead.
+*/
+static sqlite_ast *g_handle;
+static int g_busy;
+
+PyDoc_STRVAR(parse_doc,
+"parse(sql)\n"
+"--\n"
+"\n"
+"Parse the first statement of sql, which must be a SELECT, and return its\n"
+"AST as the dict that dump_ast would print as JSON. Raises ParseError if\n"
+"it does not parse or is not a SELECT.");
+
+PyDoc_STRVAR(parse_all_doc,
+"parse_all(sql)\n"
+"--\n"
+"\n"
+"Parse every statement of sql and return a list with one dict per\n"
+"statement: {\"offset\": N, \"ast\": {...}} for a SELECT, or {\"offset\":\n"
+"N, \"error\": \"...\"} for a statement that does not parse or is not a\n"
+"SELECT. offset is the byte offset of the statement in sql encoded as\n"
+"UTF-8.");
+
+/* Run parse() (all == 0) or parse_all() */
+static PyObject *parser_run(PyObject *arg, int all) {
+    Py_ssize_t nSql;
+    const char *zSql = PyUnicode_AsUTF8AndSize(arg, &nSql);
+    if (zSql == NULL) return NULL;
+    if (nSql > INT_MAX) {
+        PyErr_SetString(PyExc_ValueError, "SQL text too long");
+        return NULL;
+    }
+
+    sqlite_ast *h = g_handle;
+    int shared = !__atomic_exchange_n(&g_busy, 1, __ATOMIC_ACQUIRE);
+    if (!shared && sqlite_ast_open(0, &h) != SQLITE_AST_OK) {
+        return PyErr_NoMemory();
+    }
+
+    PyBuilder b = {0};
+    const AstEmitter *pEmit = h->ctx.pEmit;
+    void *pEmitArg = h->ctx.pEmitArg;
+    h->ctx.pEmit = &py_emitter;
+    h->ctx.pEmitArg = &b;
+    int rc = all ? ast_parse_all(h, zSql, (int)nSql) : ast_parse(h, zSql, (int)nSql);
+    h->ctx.pEmit = pEmit;
+    h->ctx.pEmitArg = pEmitArg;
+    PyMem_Free(b.aStack);
+
+    PyObject *pResult = b.pResult;
+    if (b.failed) {
+        Py_XDECREF(pResult);
+        if (!PyErr_Occurred()) PyErr_NoMemory();
+        pResult = NULL;
+    } else if (rc != SQLITE_AST_OK) {
+        Py_XDECREF(pResult);
+        if (rc == SQLITE_AST_NOMEM) {
+            PyErr_NoMemory();
+        } else {
+            PyErr_SetString(g_parse_error, sqlite_ast_errmsg(h));
+        }
+        pResult = NULL;
+    }
+    if (shared) {
+        __atomic_store_n(&g_busy, 0, __ATOMIC_RELEASE);
+    } else {
+        sqlite_ast_close(h);
+    }
+    return pResult;
+}
+
+static PyObject *parser_parse(PyObject *self, PyObject *arg) {
+    return parser_run(arg, 0);
+}
+
+static PyObject *parser_parse_all(PyObject *self, PyObject *arg) {
+    return parser_run(arg, 1);
+}
+
+static PyMethodDef parser_methods[] = {
+    {"parse", parser_parse, METH_O, parse_doc},
+    {"parse_all", parser_parse_all, METH_O, parse_all_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+static void parser_free(void *module) {
+    sqlite_ast_close(g_handle);
+    g_handle = NULL;
+}
+
+static struct PyModuleDef parser_module = {
+    PyModuleDef_HEAD_INIT,
+    "_parser",
+    "SQLite SELECT parser returning the conformance-suite AST as dicts.",
+    -1,
+    parser_methods,
+    NULL, NULL, NULL,
+    parser_free,
+};
+
+PyMODINIT_FUNC PyInit__parser(void) {
+    PyObject *m = PyModule_Create(&parser_module);
+    if (m == NULL) return NULL;
+
+    for (int i = 0; i < AST_KEY_COUNT; i++) {
+        g_py_keys[i] = PyUnicode_InternFromString(ast_key_names[i].z);
+        if (g_py_keys[i] == NULL) goto error;
+    }
+    g_py_syms[AST_SYM_NONE] = Py_None;
+    Py_INCREF(Py_None);
+    for (int i = 1; i < AST_SYM_COUNT; i++) {
+        g_py_syms[i] = PyUnicode_InternFromString(ast_sym_names[i].z);
+        if (g_py_syms[i] == NULL) goto error;
+    }
+    g_py_empty = PyUnicode_FromStringAndSize("", 0);
+    if (g_py_empty == NULL) goto error;
+
+    g_parse_error = PyErr_NewException(
+        "sqlite_ast_conformance._parser.ParseError", PyExc_ValueError, NULL);
+    if (g_parse_error == NULL) goto error;
+    Py_INCREF(g_parse_error);
+    if (PyModule_AddObject(m, "ParseError", g_parse_error) < 0) {
+        Py_DECREF(g_parse_error);
+        goto error;
+    }
+    if (sqlite_ast_open(0, &g_handle) != SQLITE_AST_OK) {
+        PyErr_NoMemory();
+        goto error;
+    }
+#ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
+    return m;
+
+error:
+    Py_DECREF(m);
+    return NULL;
+}
@@ -0,0 +1,122 @@
+"""
+All test cases packed into one file, for loading without a directory scan.
+
+ast-tests.ndjson is generated from the loose files in ast-tests/, which
+stay the source of truth. generate_test.py rebuilds it whenever it writes
+fixtures; `python generate_test.py --bundle` rebuilds it on its own.
+
+The first line of the bundle is an index:
+
+    {"version": 1, "cases": [[name, offset, length], ...]}
+
+followed by one compact JSON object {"name", "sql", "ast"} per line, in
+name order. Offsets and lengths are in bytes and count from the start of
+the line after the index. The loader memory-maps the file, reads the index,
+and decodes a case only when it is asked for.
+"""
+
+import json
+import mmap
+import os
+import tempfile
+from pathlib import Path
+
+PACKAGE_DIR = Path(__file__).parent
+AST_TESTS_DIR = PACKAGE_DIR / "ast-tests"
+AST_BUNDLE = PACKAGE_DIR / "ast-tests.ndjson"
+
+BUNDLE_VERSION = 1
+
+
+def build_bundle(tests_dir=AST_TESTS_DIR) -> bytes:
+    """Return the bundle contents for the JSON files in tests_dir."""
+    index = []
+    body = bytearray()
+    for path in sorted(Path(tests_dir).glob("*.json")):
+        with open(path, encoding="utf-8") as f:
+            data = json.load(f)
+        line = json.dumps(
+            {"name": path.stem, "sql": data["sql"], "ast": data["ast"]},
+            separators=(",", ":"),
+            ensure_ascii=False,
+        ).encode("utf-8")
+        index.append([path.stem, len(body), len(line)])
+        body += line + b"\n"
+    header = json.dumps({"version": BUNDLE_VERSION, "cases": index}, separators=(",", ":"))
+    return header.encode("utf-8") + b"\n" + bytes(body)
+
+
+def write_bundle(tests_dir=AST_TESTS_DIR, bundle_path=AST_BUNDLE) -> bool:
+    """Rebuild the bundle file if it is out of date. Returns True if written."""
+    data = build_bundle(tests_dir)
+    bundle_path = Path(bundle_path)
+    try:
+        if bundle_path.read_bytes() == data:
+            return False
+    except FileNotFoundError:
+        pass
+    # Replace the file rather than rewriting it, since readers map it
+    fd, tmp = tempfile.mkstemp(dir=bundle_path.parent, prefix=".bundle.", suffix=".tmp")
+    try:
+        with os.fdopen(fd, "wb") as f:
+            f.write(data)
+        os.chmod(tmp, 0o644)
+        os.replace(tmp, bundle_path)
+    except BaseException:
+        os.unlink(tmp)
+        raise
+    return True
+
+
+class Bundle:
+    """Read-only view of a bundle file."""
+
+    def __init__(self, path=AST_BUNDLE):
+        with open(path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        end = self._map.find(b"\n")
+        header = json.loads(self._map[:end])
+        if header.get("version") != BUNDLE_VERSION:
+            raise ValueError(f"{path}: unsupported bundle version {header.get('version')}")
+        self._base = end + 1
+        self._index = {name: (offset, length) for name, offset, length in header["cases"]}
+
+    def names(self):
+        return list(self._index)
+
+    def get(self, name):
+        offset, length = self._index[name]
+        start = self._base + offset
+        return json.loads(self._map[start : start + length])
+
+    def __iter__(self):
+        return (self.get(name) for name in self._index)
+
+    def __len__(self):
+        return len(self._index)
+
+
+_bundle = None
+
+
+def _default_bundle():
+    global _bundle
+    if _bundle is None:
+        _bundle = Bundle()
+    return _bundle
+
+
+def case_names():
+    """Names of all test cases, in sorted order."""
+    return _default_bundle().names()
+
+
+def iter_cases():
+    """Yield every test case as {"name": ..., "sql": ..., "ast": ...}."""
+    return iter(_default_bundle())
+
+
+def get_case(name):
+    """Return one test case by name. Raises KeyError if there is none."""
+    return _default_bundle().get(name)
+
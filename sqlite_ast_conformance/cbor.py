@@ -0,0 +1,178 @@
+"""
+Decoder for the CBOR output of dump_ast --format=cbor (SQLITE_AST_CBOR).
+
+The output is standard CBOR (RFC 8949) with two substitutions that keep
+it small: object keys are unsigned integers indexing KEYS, and symbol
+values (node types, operators, join types, ...) are simple values
+SYMBOL_BASE + i standing for SYMBOLS[i]. decode() maps them back, so it
+returns exactly the dicts the JSON fixtures contain. Text keys are kept
+as they are, which is how batch records ({"id", "ast", "error",
+"stats"}) are written; the records of dump_ast --all use integer keys.
+
+KEYS and SYMBOLS are copies of the AST_KEYS and AST_SYMS lists in
+sqlite_ast.c, in the same order; entries are only ever added at the end.
+
+    from sqlite_ast_conformance import cbor
+    tree = cbor.decode(subprocess.check_output(
+        ["build/dump_ast", "--format=cbor", "SELECT 1"]))
+"""
+
+import struct
+
+KEYS = (
+    "type", "value", "name", "left", "right", "expr", "as", "operand",
+    "when_clauses", "when", "then", "else", "low", "high", "select",
+    "values", "collation", "args", "distinct", "order_by", "over", "op",
+    "action", "message", "text", "alias", "direction", "nulls", "schema",
+    "join_type", "on", "using", "columns", "materialized", "base",
+    "partition_by", "frame", "start", "end", "exclude", "filter", "body",
+    "operator", "all", "from", "where", "group_by", "having", "limit",
+    "offset", "with", "window_definitions",
+    # Records of SQLITE_AST_ALL
+    "ast", "error",
+)
+
+SYMBOLS = (
+    # Node types
+    "integer", "float", "string", "blob", "null", "boolean", "name",
+    "dot", "star", "parameter", "cast", "case", "between", "in", "exists",
+    "subquery", "collate", "function", "unary", "isnull", "notnull",
+    "truth_test", "raise", "vector", "span", "binary", "unknown",
+    "select", "compound", "table",
+    # Operators
+    "AND", "OR", "<", "<=", ">", ">=", "=", "!=", "IS", "IS NOT", "+", "-",
+    "*", "/", "%", "&", "|", "<<", ">>", "||", "LIKE", "MATCH", "~", "NOT",
+    "IS FALSE", "IS TRUE", "IS NOT FALSE", "IS NOT TRUE",
+    # RAISE actions
+    "ROLLBACK", "ABORT", "FAIL", "IGNORE",
+    # ORDER BY
+    "ASC", "DESC", "FIRST", "LAST",
+    # Joins
+    "JOIN", "CROSS JOIN", "NATURAL JOIN", "LEFT JOIN", "NATURAL LEFT JOIN",
+    "RIGHT JOIN", "NATURAL RIGHT JOIN", "FULL OUTER JOIN",
+    "NATURAL FULL OUTER JOIN",
+    # CTE materialization
+    "MATERIALIZED", "NOT MATERIALIZED",
+    # Window frames
+    "ROWS", "RANGE", "GROUPS", "UNBOUNDED", "CURRENT ROW", "PRECEDING",
+    "FOLLOWING", "NO OTHERS", "GROUP", "TIES",
+    # Compound operators
+    "UNION", "UNION ALL", "INTERSECT", "EXCEPT",
+)
+
+# Simple value of SYMBOLS[0]; lower ones are reserved by CBOR
+SYMBOL_BASE = 32
+
+_FLOAT_FORMATS = {25: ">e", 26: ">f", 27: ">d"}
+_SIMPLE = {20: False, 21: True, 22: None, 23: None}
+_BREAK = object()
+_NO_KEY = object()
+
+
+class DecodeError(ValueError):
+    pass
+
+
+def _decode_item(data, pos):
+    """Decode the item starting at data[pos]. Returns (value, end)."""
+    # Open arrays and maps: [container, items left or None, pending key]
+    stack = []
+    end = len(data)
+    while True:
+        if pos >= end:
+            raise DecodeError("truncated CBOR data")
+        major, info = data[pos] >> 5, data[pos] & 0x1F
+        pos += 1
+        if info < 24:
+            arg = info
+        elif info < 28:
+            n = 1 << (info - 24)
+            if pos + n > end:
+                raise DecodeError("truncated CBOR data")
+            arg = int.from_bytes(data[pos : pos + n], "big")
+            pos += n
+        elif info == 31 and major in (4, 5, 7):
+            arg = None
+        else:
+            raise DecodeError(f"unsupported CBOR initial byte 0x{data[pos - 1]:02x}")
+
+        if major == 0:
+            value = arg
+        elif major == 1:
+            value = -1 - arg
+        elif major == 2 or major == 3:
+            if pos + arg > end:
+                raise DecodeError("truncated CBOR data")
+            value = bytes(data[pos : pos + arg])
+            if major == 3:
+                value = value.decode("utf-8")
+            pos += arg
+        elif major == 4 or major == 5:
+            container = [] if major == 4 else {}
+            if arg != 0:
+                stack.append([container, arg, _NO_KEY])
+                continue
+            value = container
+        elif major == 6:
+            continue  # tags carry no meaning here; decode the tagged item
+        elif arg is None:
+            value = _BREAK
+        elif info in _FLOAT_FORMATS:
+            value = struct.unpack(_FLOAT_FORMATS[info], data[pos - n : pos])[0]
+        elif arg in _SIMPLE:
+            value = _SIMPLE[arg]
+        elif SYMBOL_BASE <= arg < SYMBOL_BASE + len(SYMBOLS):
+            value = SYMBOLS[arg - SYMBOL_BASE]
+        else:
+            raise DecodeError(f"unknown simple value {arg}")
+
+        # Attach the value to the innermost container, closing any it fills
+        while True:
+            if not stack:
+                if value is _BREAK:
+                    raise DecodeError("unexpected break")
+                return value, pos
+            top = stack[-1]
+            container, left, key = top
+            if value is _BREAK:
+                if left is not None or key is not _NO_KEY:
+                    raise DecodeError("unexpected break")
+                stack.pop()
+                value = container
+                continue
+            if type(container) is list:
+                container.append(value)
+            elif key is _NO_KEY:
+                if type(value) is int:
+                    if not 0 <= value < len(KEYS):
+                        raise DecodeError(f"unknown key id {value}")
+                    value = KEYS[value]
+                top[2] = value
+                break
+            else:
+                container[key] = value
+                top[2] = _NO_KEY
+            if left is not None:
+                top[1] = left - 1
+                if left == 1:
+                    stack.pop()
+                    value = container
+                    continue
+            break
+
+
+def decode(data):
+    """Decode one CBOR AST (or batch record) from a bytes-like object."""
+    value, pos = _decode_item(data, 0)
+    if pos != len(data):
+        raise DecodeError("trailing data after CBOR item")
+    return value
+
+
+def iter_decode(data):
+    """Yield each item of a CBOR sequence, such as the records written by
+    dump_ast --batch --format=cbor."""
+    pos = 0
+    while pos < len(data):
+        value, pos = _decode_item(data, pos)
+        yield value
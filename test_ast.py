@@ -3,9 +3,15 @@ Conformance tests for SQLite SELECT query AST parsing.
 
 Loads JSON test files from ast-tests/ and verifies that the dump_ast tool
 (which uses the official SQLite parser) produces the expected AST for each
-SQL query.
+SQL query. Every query goes through a single dump_ast --batch process, so
+large fixture sets do not pay for a process start per test. ASTs are never
+taken from the cache in build/ (see ast_cache.py), so every run tests the
+parser as built. When the native
+extension has been built (make python-ext) it is used instead of dump_ast,
+and is also checked against dump_ast.
 """
 
+import gc
 import json
 import subprocess
 import sys
@@ -13,6 +19,9 @@ from pathlib import Path
 
 import pytest
 
+from ast_cache import run_batch
+from sqlite_ast_conformance import ParseError, parse, parse_all
+
 # Path to the dump_ast binary
 DUMP_AST = Path(__file__).parent / "build" / "dump_ast"
 AST_TESTS_DIR = Path(__file__).parent / "sqlite_ast_conformance" / "ast-tests"
@@ -24,13 +33,15 @@ def load_test_cases():
     for path in sorted(AST_TESTS_DIR.glob("*.json")):
         with open(path) as f:
             data = json.load(f)
-        cases.append(pytest.param(data["sql"], data["ast"], id=path.stem))
+        cases.append(pytest.param(path.stem, data["sql"], data["ast"], id=path.stem))
     return cases
 
 
-@pytest.mark.parametrize("sql, expected_ast", load_test_cases())
-def test_select_ast(sql, expected_ast):
-    """Verify that parsing the SQL produces the expected AST."""
+TEST_CASES = load_test_cases()
+
+
+def dump_ast(sql):
+    """Run dump_ast on one query and return the parsed JSON AST."""
     result = subprocess.run(
         [str(DUMP_AST), sql],
         capture_output=True,
@@ -40,9 +51,86 @@ def test_select_ast(sql, expected_ast):
     assert result.returncode == 0, (
         f"dump_ast failed for: {sql}\nstderr: {result.stderr}"
     )
-    actual_ast = json.loads(result.stdout)
+    return json.loads(result.stdout)
+
+
+@pytest.fixture(scope="session")
+def batch_records():
+    """Parse every test case with one dump_ast --batch run.
+
+    Returns the output records keyed by test case name. Not needed (and
+    empty) when the native extension is available.
+    """
+    if parse is not None:
+        return {}
+    records = run_batch([case.values[1] for case in TEST_CASES], DUMP_AST)
+    return {case.values[0]: record for case, record in zip(TEST_CASES, records)}
+
+
+@pytest.mark.parametrize("name, sql, expected_ast", TEST_CASES)
+def test_select_ast(name, sql, expected_ast, batch_records):
+    """Verify that parsing the SQL produces the expected AST."""
+    if parse:
+        actual_ast = parse(sql)
+    else:
+        record = batch_records[name]
+        assert "error" not in record, f"dump_ast failed for: {sql}\n{record['error']}"
+        actual_ast = record["ast"]
     assert actual_ast == expected_ast, (
         f"AST mismatch for: {sql}\n"
         f"Expected:\n{json.dumps(expected_ast, indent=2)}\n"
         f"Actual:\n{json.dumps(actual_ast, indent=2)}"
     )
+
+
+needs_native = pytest.mark.skipif(parse is None, reason="make python-ext")
+
+
+@needs_native
+def test_native_matches_dump_ast():
+    for sql in ["SELECT 'a\nb', x'00', -1", "SELECT * FROM t ORDER BY 1 DESC"]:
+        assert parse(sql) == dump_ast(sql)
+
+
+@needs_native
+def test_native_parse_errors():
+    with pytest.raises(ParseError, match="^Parse error:"):
+        parse("SELECT FROM WHERE")
+    with pytest.raises(ParseError, match="No SELECT statement found"):
+        parse("CREATE TABLE t(a)")
+    assert parse("SELECT 1")["type"] == "select"
+
+
+@needs_native
+def test_native_parse_all():
+    # Offsets count UTF-8 bytes, as they do in dump_ast --all
+    script = "SELECT 'é'; DELETE FROM t; SELECT 2"
+    records = parse_all(script)
+    assert [r["offset"] for r in records] == [0, 13, 28]
+    assert records[0]["ast"] == parse("SELECT 'é'")
+    assert "error" in records[1]
+    assert records[2]["ast"] == parse("SELECT 2")
+
+
+@needs_native
+def test_native_parse_reentrant():
+    # Building the dicts can run the garbage collector, and so a __del__
+    # that parses again while the module's handle is still in use
+    nested = []
+
+    class Reparse:
+        def __del__(self):
+            nested.append(parse("SELECT 2"))
+
+    expected = parse("SELECT 1, 'x'")
+    threshold = gc.get_threshold()
+    gc.set_threshold(1)
+    try:
+        for _ in range(20):
+            garbage = Reparse()
+            garbage.cycle = garbage
+            del garbage
+            assert parse("SELECT 1, 'x'") == expected
+    finally:
+        gc.set_threshold(*threshold)
+    assert nested and all(ast == parse("SELECT 2") for ast in nested)
@@ -0,0 +1,60 @@
+"""
+Tests for the dump_ast output cache in ast_cache.py.
+"""
+
+import shutil
+import sqlite3
+
+from ast_cache import DUMP_AST, AstCache, run_batch
+
+QUERIES = ["SELECT 1", "SELECT a FROM t WHERE b > 2", "CREATE TABLE t(a)"]
+
+
+def test_cache_matches_dump_ast(tmp_path):
+    path = tmp_path / "cache.db"
+    expected = run_batch(QUERIES)
+    cache = AstCache(path)
+    assert cache.parse_many(QUERIES) == expected
+    cache.close()
+
+    # Successful parses are now served from the cache, not the parser
+    with sqlite3.connect(path) as db:
+        db.execute("""UPDATE asts SET ast = '"cached"'""")
+    db.close()
+    cache = AstCache(path)
+    assert cache.parse_many(QUERIES[:2]) == [{"ast": "cached"}] * 2
+    cache.close()
+
+
+def test_cache_invalidated_by_version_change(tmp_path):
+    path = tmp_path / "cache.db"
+    cache = AstCache(path)
+    cache.parse_many(QUERIES)
+    cache.close()
+
+    with sqlite3.connect(path) as db:
+        assert db.execute("SELECT count(*) FROM asts").fetchone() == (2,)
+        db.execute("UPDATE meta SET version = 'older parser'")
+    db.close()
+
+    AstCache(path).close()
+    with sqlite3.connect(path) as db:
+        assert db.execute("SELECT count(*) FROM asts").fetchone() == (0,)
+    db.close()
+
+
+def test_cache_invalidated_by_rebuild(tmp_path):
+    # A rebuilt dump_ast may write different ASTs under the same version
+    path = tmp_path / "cache.db"
+    cache = AstCache(path)
+    cache.parse_many(QUERIES)
+    cache.close()
+
+    rebuilt = tmp_path / "dump_ast"
+    shutil.copy(DUMP_AST, rebuilt)
+    with open(rebuilt, "ab") as f:
+        f.write(b"\0")
+    AstCache(path, dump_ast=rebuilt).close()
+    with sqlite3.connect(path) as db:
+        assert db.execute("SELECT count(*) FROM asts").fetchone() == (0,)
+    db.close()
@@ -0,0 +1,33 @@
+"""
+Tests for the packed fixture bundle (sqlite_ast_conformance/bundle.py).
+"""
+
+import json
+
+import pytest
+
+from sqlite_ast_conformance import AST_BUNDLE, AST_TESTS_DIR, case_names, get_case, iter_cases
+from sqlite_ast_conformance.bundle import build_bundle
+
+
+def test_bundle_is_up_to_date():
+    assert AST_BUNDLE.read_bytes() == build_bundle(AST_TESTS_DIR), (
+        "ast-tests.ndjson is stale: run python generate_test.py --bundle"
+    )
+
+
+def test_bundle_matches_loose_files():
+    paths = sorted(AST_TESTS_DIR.glob("*.json"))
+    assert case_names() == [path.stem for path in paths]
+    for case, path in zip(iter_cases(), paths):
+        with open(path) as f:
+            data = json.load(f)
+        assert case == {"name": path.stem, "sql": data["sql"], "ast": data["ast"]}
+
+
+def test_get_case():
+    with open(AST_TESTS_DIR / "kitchen_sink.json") as f:
+        data = json.load(f)
+    assert get_case("kitchen_sink")["ast"] == data["ast"]
+    with pytest.raises(KeyError):
+        get_case("no_such_case")
@@ -0,0 +1,558 @@
+"""
+Tests for dump_ast command-line modes other than the single-query default.
+"""
+
+import json
+import os
+import re
+import subprocess
+from pathlib import Path
+
+from sqlite_ast_conformance import cbor
+
+# Path to the dump_ast binary
+DUMP_AST = Path(__file__).parent / "build" / "dump_ast"
+AST_TESTS_DIR = Path(__file__).parent / "sqlite_ast_conformance" / "ast-tests"
+
+
+def load_fixtures():
+    fixtures = {}
+    for path in sorted(AST_TESTS_DIR.glob("*.json")):
+        with open(path) as f:
+            fixtures[path.stem] = json.load(f)
+    return fixtures
+
+
+def compact_json(value):
+    """The byte-exact form dump_ast uses for compact output."""
+    return json.dumps(value, separators=(",", ":"), ensure_ascii=False)
+
+
+def run_batch(lines, args=()):
+    """Feed request lines to dump_ast --batch and return the parsed records."""
+    result = subprocess.run(
+        [str(DUMP_AST), "--batch", *args],
+        input="".join(line + "\n" for line in lines),
+        capture_output=True,
+        text=True,
+        timeout=60,
+    )
+    assert result.returncode == 0, result.stderr
+    return [json.loads(line) for line in result.stdout.splitlines()]
+
+
+def test_compact_output():
+    for name, data in load_fixtures().items():
+        result = subprocess.run(
+            [str(DUMP_AST), "--compact", data["sql"]],
+            capture_output=True,
+            text=True,
+            timeout=10,
+        )
+        assert result.returncode == 0, f"{name}: {result.stderr}"
+        assert result.stdout == compact_json(data["ast"]) + "\n", name
+
+
+def test_batch_matches_fixtures():
+    fixtures = load_fixtures()
+    records = run_batch(
+        json.dumps({"id": name, "sql": data["sql"]})
+        for name, data in fixtures.items()
+    )
+    assert [r["id"] for r in records] == list(fixtures)
+    for record in records:
+        assert record["ast"] == fixtures[record["id"]]["ast"], record["id"]
+
+
+def test_batch_errors_do_not_stop_the_stream():
+    records = run_batch([
+        json.dumps({"id": 1, "sql": "SELECT FROM WHERE"}),
+        "not json",
+        json.dumps({"id": [2, "x"], "sql": "CREATE TABLE t(a)"}),
+        json.dumps({"sql": "SELECT 'café'"}),
+    ])
+    assert len(records) == 4
+    assert records[0]["id"] == 1
+    assert records[0]["error"].startswith("Parse error:")
+    assert records[1] == {"id": None, "error": "request is not a JSON object"}
+    assert records[2] == {
+        "id": [2, "x"],
+        "error": "No SELECT statement found in input",
+    }
+    assert records[3]["id"] is None
+    column = records[3]["ast"]["columns"][0]["expr"]
+    assert column == {"type": "string", "value": "café"}
+
+    # An id that is not valid JSON is rejected rather than echoed
+    bad_ids = ["abc", "[1 2]", '{"a" 1}', "[1,]", "1.", "-", "tru", '{1: 2}']
+    records = run_batch(
+        ['{"id": %s, "sql": "SELECT 1"}' % bad for bad in bad_ids]
+        + ['{"id": {"a": [1, -2.5e3, true, null, {}]}, "sql": "SELECT 1"}']
+    )
+    assert records[:-1] == [
+        {"id": None, "error": "malformed JSON in request"}
+    ] * len(bad_ids)
+    assert records[-1]["id"] == {"a": [1, -2500.0, True, None, {}]}
+
+
+def test_batch_read_error_fails():
+    # Reading a directory fails with EISDIR rather than looking like the end
+    fd = os.open(Path(__file__).parent, os.O_RDONLY)
+    try:
+        result = subprocess.run(
+            [str(DUMP_AST), "--batch"], stdin=fd, capture_output=True, timeout=10
+        )
+    finally:
+        os.close(fd)
+    assert result.returncode != 0
+    assert b"Error reading input" in result.stderr
+
+
+def test_batch_huge_ast():
+    """A 3M-element IN list serializes to more than 100MB of JSON."""
+    n = 3_000_000
+    sql = "SELECT 1 IN (" + ",".join(map(str, range(n))) + ")"
+    result = subprocess.run(
+        [str(DUMP_AST), "--batch"],
+        input=(json.dumps({"id": 1, "sql": sql}) + "\n").encode(),
+        capture_output=True,
+        timeout=600,
+    )
+    assert result.returncode == 0, result.stderr
+    out = result.stdout
+    assert len(out) > 100 * 1024 * 1024
+    assert out.startswith(b'{"id":1,"ast":{"type":"select",')
+    assert out.count(b'{"type":"integer"') == n + 1
+    assert out.endswith(
+        b'{"type":"integer","value":%d}]},"alias":null}],' % (n - 1)
+        + b'"from":null,"where":null,"group_by":null,"having":null,'
+        + b'"order_by":null,"limit":null}}\n'
+    )
+
+
+def select_json(expr):
+    """Compact JSON for `SELECT <expr>`, where expr is already compact JSON."""
+    return (
+        '{"type":"select","distinct":false,"all":false,"columns":[{"expr":'
+        + expr
+        + ',"alias":null}],"from":null,"where":null,"group_by":null,'
+        '"having":null,"order_by":null,"limit":null}'
+    )
+
+
+def dump_compact(sql):
+    return subprocess.run(
+        [str(DUMP_AST), "--compact", sql],
+        capture_output=True,
+        text=True,
+        timeout=60,
+    )
+
+
+def test_deepest_expression_trees():
+    """Trees as deep as SQLite accepts serialize without recursion.
+
+    The expected output is built as a string, since json.loads() would
+    itself recurse once per level.
+    """
+    n = 900
+    one = '{"type":"integer","value":1}'
+    expr = one
+    for _ in range(n - 1):
+        expr = '{"type":"binary","op":"+","left":' + expr + ',"right":' + one + "}"
+    result = dump_compact("SELECT " + "+".join(["1"] * n))
+    assert result.returncode == 0, result.stderr
+    assert result.stdout == select_json(expr) + "\n"
+
+    expr = '{"type":"name","name":"x"}'
+    for _ in range(n):
+        expr = '{"type":"isnull","operand":' + expr + "}"
+    result = dump_compact("SELECT x" + " ISNULL" * n)
+    assert result.returncode == 0, result.stderr
+    assert result.stdout == select_json(expr) + "\n"
+
+
+def test_expression_depth_limit():
+    """Beyond SQLITE_MAX_EXPR_DEPTH the parser reports an error."""
+    result = dump_compact("SELECT " + "+".join(["1"] * 100_000))
+    assert result.returncode != 0
+    assert result.stdout == ""
+    assert "Expression tree is too large" in result.stderr
+
+
+def count_types(value, counts):
+    """Count the "type" of every node in a JSON AST."""
+    if isinstance(value, dict):
+        if "type" in value:
+            counts[value["type"]] = counts.get(value["type"], 0) + 1
+        for child in value.values():
+            count_types(child, counts)
+    elif isinstance(value, list):
+        for child in value:
+            count_types(child, counts)
+    return counts
+
+
+def test_stats():
+    data = load_fixtures()["kitchen_sink"]
+    result = subprocess.run(
+        [str(DUMP_AST), "--stats", data["sql"]],
+        capture_output=True,
+        timeout=10,
+    )
+    assert result.returncode == 0, result.stderr
+    stats = json.loads(result.stderr)
+    assert stats["node_types"] == count_types(data["ast"], {})
+    assert stats["nodes"] == sum(stats["node_types"].values())
+    assert stats["output_bytes"] == len(result.stdout) - 1
+    assert stats["total_ns"] == (
+        stats["parse_ns"] + stats["serialize_ns"] + stats["finish_ns"]
+    )
+    assert stats["memory"]["used_highwater"] >= stats["memory"]["used_at_start"]
+    # sqlite_ast_open() ignores a failure to set up lookaside; this catches it
+    assert stats["lookaside"]["hit"] > 0
+
+    result = subprocess.run(
+        [str(DUMP_AST), "--batch", "--stats"],
+        input=json.dumps({"id": 1, "sql": data["sql"]}) + "\n"
+        + json.dumps({"id": 2, "sql": "SELECT FROM WHERE"}) + "\n"
+        + "not json\n",
+        capture_output=True,
+        text=True,
+        timeout=10,
+    )
+    assert result.returncode == 0, result.stderr
+    ok, error, bad = [json.loads(line) for line in result.stdout.splitlines()]
+    assert ok["ast"] == data["ast"]
+    assert ok["stats"]["node_types"] == stats["node_types"]
+    assert ok["stats"]["output_bytes"] == len(compact_json(data["ast"]).encode())
+    assert error["stats"]["nodes"] == 0
+    assert "stats" not in bad
+
+
+def test_long_compound_chains():
+    """Compounds with thousands of arms, nested in subqueries, keep their
+    arms in order. SQLite's 500-term limit does not stop the capture."""
+    arms = " UNION ALL ".join(f"SELECT {i}" for i in range(10_000))
+    sql = f"SELECT ({arms}), ({arms} ORDER BY 1)"
+    # Too long for a command-line argument, so it goes through --batch
+    [record] = run_batch([json.dumps({"id": 1, "sql": sql})])
+    assert "error" not in record, record["error"]
+    columns = record["ast"]["columns"]
+    for column in columns:
+        compound = column["expr"]["select"]
+        assert compound["type"] == "compound"
+        body = compound["body"]
+        assert len(body) == 10_000
+        assert "operator" not in body[0]
+        assert {arm.get("operator") for arm in body[1:]} == {"UNION ALL"}
+        values = [arm["select"]["columns"][0]["expr"]["value"] for arm in body]
+        assert values == list(range(10_000))
+    assert columns[0]["expr"]["select"]["order_by"] is None
+    assert columns[1]["expr"]["select"]["order_by"] == [
+        {"expr": {"type": "integer", "value": 1}, "direction": "ASC"}
+    ]
+
+
+def test_cbor_batch_matches_fixtures():
+    fixtures = load_fixtures()
+    requests = [
+        json.dumps({"id": name, "sql": data["sql"]}) for name, data in fixtures.items()
+    ]
+    requests += [
+        json.dumps({"id": 1, "sql": "SELECT FROM WHERE"}),
+        "not json",
+        json.dumps({"id": [2, "x"], "sql": "SELECT ~5"}),
+    ]
+    result = subprocess.run(
+        [str(DUMP_AST), "--batch", "--format=cbor"],
+        input="".join(line + "\n" for line in requests).encode(),
+        capture_output=True,
+        timeout=60,
+    )
+    assert result.returncode == 0, result.stderr
+    records = list(cbor.iter_decode(result.stdout))
+    assert len(records) == len(fixtures) + 3
+    for record in records[: len(fixtures)]:
+        assert record["ast"] == fixtures[record["id"]]["ast"], record["id"]
+    error, bad, other_id = records[len(fixtures) :]
+    assert error["id"] == 1
+    assert error["error"].startswith("Parse error:")
+    assert bad == {"id": None, "error": "request is not a JSON object"}
+    assert other_id["id"] == '[2, "x"]'
+    assert other_id["ast"]["columns"][0]["expr"] == {
+        "type": "unary",
+        "op": "~",
+        "operand": {"type": "integer", "value": 5},
+    }
+
+
+def test_cbor_output():
+    """The same tree as the JSON, including ones too deep to recurse over."""
+    for sql in ["SELECT 'café', x'00ff', ?1 FROM t", "SELECT " + "+".join(["1"] * 900)]:
+        result = subprocess.run(
+            [str(DUMP_AST), "--format=cbor", sql], capture_output=True, timeout=10
+        )
+        assert result.returncode == 0, result.stderr
+        assert len(result.stdout) < len(dump_compact(sql).stdout.encode())
+        tree = cbor.decode(result.stdout)
+        # Compared as text, since json.loads() recurses once per level
+        assert compact_json(tree) + "\n" == dump_compact(sql).stdout
+
+
+def test_cbor_vocabulary_matches_library():
+    source = (Path(__file__).parent / "sqlite_ast.c").read_text()
+    keys = source[source.index("#define AST_KEYS(X)") :].split("\n\n", 1)[0]
+    syms = source[source.index("#define AST_SYMS(X)") :].split("\n\n", 1)[0]
+    assert cbor.KEYS == tuple(re.findall(r"X\((\w+)\)", keys))
+    assert cbor.SYMBOLS == tuple(re.findall(r'X\(\w+, "([^"]*)"\)', syms))
+
+
+def test_split():
+    script = (
+        "-- report\nSELECT 1; ;\n"
+        "SELECT 'a;b' /* ; */ FROM t;\n"
+        "CREATE TRIGGER tr AFTER INSERT ON t BEGIN SELECT 1; DELETE FROM u; END;\n"
+        "SELECT 2"
+    )
+    result = subprocess.run(
+        [str(DUMP_AST), "--split", script], capture_output=True, text=True, timeout=60
+    )
+    assert result.returncode == 0, result.stderr
+    records = [json.loads(line) for line in result.stdout.splitlines()]
+    assert [r["offset"] for r in records] == [
+        script.index("SELECT 1"),
+        script.index("SELECT 'a"),
+        script.index("CREATE"),
+        script.index("SELECT 2"),
+    ]
+    assert records[1]["ast"]["columns"][0]["expr"] == {"type": "string", "value": "a;b"}
+    assert "ast" not in records[2]
+    assert records[3]["ast"]["columns"][0]["expr"] == {"type": "integer", "value": 2}
+
+    # In batch mode each statement's record has its request's id
+    records = run_batch(
+        [
+            json.dumps({"id": "r", "sql": "SELECT 1;SELECT 2;"}),
+            json.dumps({"id": 2, "sql": " -- nothing"}),
+        ],
+        ["--split"],
+    )
+    assert [(r["id"], r["offset"]) for r in records] == [("r", 0), ("r", 9)]
+
+
+def test_all_statements():
+    script = "SELECT 1; CREATE TABLE t(x);\nSELECT FROM WHERE; SELECT 'a;b' FROM t"
+    result = subprocess.run(
+        [str(DUMP_AST), "--compact", "--all", script],
+        capture_output=True,
+        text=True,
+        timeout=60,
+    )
+    assert result.returncode == 0, result.stderr
+    records = json.loads(result.stdout)
+    assert [r["offset"] for r in records] == [
+        0,
+        script.index("CREATE"),
+        script.index("SELECT FROM"),
+        script.index("SELECT 'a"),
+    ]
+    single = run_batch(
+        json.dumps({"id": i, "sql": sql})
+        for i, sql in enumerate(["SELECT 1", "SELECT 'a;b' FROM t"])
+    )
+    assert records[0]["ast"] == single[0]["ast"]
+    assert records[1]["error"] == "No SELECT statement found in input"
+    assert records[2]["error"].startswith("Parse error:")
+    assert records[3]["ast"] == single[1]["ast"]
+
+
+def test_input_file(tmp_path):
+    # A file that ends on a page boundary has nothing after it in its own
+    # mapping, so this also checks the NUL that dump_ast maps after it
+    head, tail = "SELECT 1; DELETE FROM t;\n-- ", "\nSELECT 'a;b'"
+    script = head + "c" * (4096 - len(head) - len(tail)) + tail
+    path = tmp_path / "script.sql"
+    path.write_text(script)
+    assert path.stat().st_size == 4096
+
+    def run(*args):
+        result = subprocess.run(
+            [str(DUMP_AST), *args], capture_output=True, text=True, timeout=60
+        )
+        assert result.returncode == 0, result.stderr
+        return result.stdout
+
+    assert run("--split", "--input", str(path)) == run("--split", script)
+    assert run("--input", str(path)) == run("SELECT 1")
+    assert run("--compact", "--all", "--input", str(path)) == run(
+        "--compact", "--all", script
+    )
+
+
+LITERAL_TYPES = {"integer", "float", "string", "blob", "parameter"}
+
+
+def fingerprint(ast):
+    """The hash sqlite_ast_fingerprint() computes, from a JSON AST: FNV-1a
+    over its events, with each literal node replaced by {"type": "?"}."""
+    out = bytearray()
+    stack = [ast]
+    while stack:
+        value = stack.pop()
+        if isinstance(value, bytes):
+            out += value
+        elif isinstance(value, dict):
+            if value.get("type") in LITERAL_TYPES:
+                value = {"type": "?"}
+            items = [b"{"]
+            for key, child in value.items():
+                items += [b"k" + key.encode() + b"\0", child]
+            stack += reversed(items + [b"}"])
+        elif isinstance(value, list):
+            stack += reversed([b"["] + value + [b"]"])
+        elif value is None:
+            out += b"n"
+        elif value is True or value is False:
+            out += b"t" if value else b"f"
+        elif isinstance(value, int):
+            out += b"i" + str(value).encode() + b"\0"
+        else:
+            out += b"s" + value.encode() + b"\0"
+    h = 0xCBF29CE484222325
+    for byte in out:
+        h = ((h ^ byte) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    return f"{h:016x}"
+
+
+def test_fingerprint():
+    fixtures = load_fixtures()
+    requests = [
+        json.dumps({"id": name, "sql": data["sql"]}) for name, data in fixtures.items()
+    ]
+    records = run_batch(requests, ["--fingerprint"])
+    assert [r["id"] for r in records] == list(fixtures)
+    for record in records:
+        ast = fixtures[record["id"]]["ast"]
+        assert record["fingerprint"] == fingerprint(ast), record["id"]
+
+    # Same shape, different literals, spacing, case and comments
+    same = [
+        "SELECT a, 1 FROM t WHERE b = 'x' AND c IN (1, 2, 3) LIMIT 10",
+        "select a,2 from t -- note\n where b='yy' and c in (4,5,6) limit ?1;",
+        "SELECT a, 3.5 FROM t WHERE b = x'00' AND c IN (:p, @q, $r) LIMIT :n",
+    ]
+    records = run_batch(
+        [json.dumps({"id": i, "sql": sql}) for i, sql in enumerate(same)], ["--fingerprint"]
+    )
+    assert {r["fingerprint"] for r in records} == {records[0]["fingerprint"]}
+    assert {r["shape"] for r in records} == {
+        "SELECT a, ? FROM t WHERE b = ? AND c IN (?, ?, ?) LIMIT ?"
+    }
+
+    # A different structure, and more list items, change the fingerprint
+    records = run_batch(
+        [
+            json.dumps({"id": 0, "sql": same[0]}),
+            json.dumps({"id": 1, "sql": same[0].replace("(1, 2, 3)", "(1, 2)")}),
+            json.dumps({"id": 2, "sql": same[0].replace("b =", "b <")}),
+            json.dumps({"id": 3, "sql": "SELECT FROM WHERE"}),
+        ],
+        ["--fingerprint"],
+    )
+    assert len({r.get("fingerprint") for r in records[:3]}) == 3
+    assert records[3]["error"].startswith("Parse error:")
+
+    # Keywords used as names are identifiers, kept as written
+    records = run_batch(
+        [
+            json.dumps({"id": 0, "sql": "select key, replace(x, 'a', 'b') from t"}),
+            json.dumps({"id": 1, "sql": "SELECT KEY, REPLACE(x, 'a', 'b') FROM t"}),
+            json.dumps({"id": 2, "sql": "select rows from t order by first desc nulls first"}),
+        ],
+        ["--fingerprint"],
+    )
+    assert [r["shape"] for r in records] == [
+        "SELECT key, replace(x, ?, ?) FROM t",
+        "SELECT KEY, REPLACE(x, ?, ?) FROM t",
+        "SELECT rows FROM t ORDER BY first DESC NULLS FIRST",
+    ]
+    assert records[0]["fingerprint"] != records[1]["fingerprint"]
+
+
+def subtree_hashes(ast):
+    """The table sqlite_ast_subtrees() builds from a JSON AST: [hash, type,
+    nodes] for every node, children first. An object is hashed like a
+    fingerprint, but with its literals kept and each object nested in it
+    contributing b"h" and its own hash in 8 little-endian bytes."""
+
+    def fnv(h, data):
+        for byte in data:
+            h = ((h ^ byte) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+        return h
+
+    end = object()
+    table = []
+    frames = []  # [hash, type, nodes below] of each open object
+    stack = [ast]
+    while stack:
+        value = stack.pop()
+        if value is end:
+            h, node_type, nodes = frames.pop()
+            h = fnv(h, b"}")
+            if node_type is not None:
+                nodes += 1
+                table.append([f"{h:016x}", node_type, nodes])
+            if frames:
+                frames[-1][0] = fnv(frames[-1][0], b"h" + h.to_bytes(8, "little"))
+                frames[-1][2] += nodes
+            continue
+        if isinstance(value, dict):
+            frames.append([fnv(0xCBF29CE484222325, b"{"), value.get("type"), 0])
+            items = []
+            for key, child in value.items():
+                items += [b"k" + key.encode() + b"\0", child]
+            stack += reversed(items + [end])
+            continue
+        if isinstance(value, list):
+            stack += reversed([b"["] + value + [b"]"])
+            continue
+        if isinstance(value, bytes):
+            data = value
+        elif value is None:
+            data = b"n"
+        elif value is True or value is False:
+            data = b"t" if value else b"f"
+        elif isinstance(value, int):
+            data = b"i" + str(value).encode() + b"\0"
+        else:
+            data = b"s" + value.encode() + b"\0"
+        frames[-1][0] = fnv(frames[-1][0], data)
+    return table
+
+
+def test_subtrees():
+    fixtures = load_fixtures()
+    requests = [
+        json.dumps({"id": name, "sql": data["sql"]}) for name, data in fixtures.items()
+    ]
+    records = run_batch(requests, ["--subtrees"])
+    assert [r["id"] for r in records] == list(fixtures)
+    for record in records:
+        assert record["subtrees"] == subtree_hashes(record["ast"]), record["id"]
+        assert record["subtrees"][-1][2] == len(record["subtrees"])
+
+    # The same subquery hashes the same wherever it appears
+    sub = "SELECT a FROM t WHERE b > 1"
+    records = run_batch(
+        [
+            json.dumps({"id": 0, "sql": f"SELECT * FROM ({sub})"}),
+            json.dumps({"id": 1, "sql": f"SELECT x FROM u WHERE y IN ({sub}) ORDER BY 1"}),
+            json.dumps({"id": 2, "sql": sub}),
+        ],
+        ["--subtrees", "--fingerprint"],
+    )
+    root = records[2]["subtrees"][-1]
+    assert root[1] == "select"
+    assert root in records[0]["subtrees"][:-1]
+    assert root in records[1]["subtrees"][:-1]
@@ -0,0 +1,131 @@
+"""
+Tests for parse_corpus, the multi-threaded corpus parser.
+"""
+
+import json
+import subprocess
+from pathlib import Path
+
+# Path to the parse_corpus binary
+PARSE_CORPUS = Path(__file__).parent / "build" / "parse_corpus"
+AST_TESTS_DIR = Path(__file__).parent / "sqlite_ast_conformance" / "ast-tests"
+
+
+def run_corpus(*args):
+    result = subprocess.run(
+        [str(PARSE_CORPUS), *map(str, args)],
+        capture_output=True,
+        text=True,
+        timeout=120,
+    )
+    assert result.returncode == 0, result.stderr
+    return [json.loads(line) for line in result.stdout.splitlines()]
+
+
+def test_fixtures_in_input_order(tmp_path):
+    fixtures = [
+        json.loads(path.read_text())
+        for path in sorted(AST_TESTS_DIR.glob("*.json"))
+    ]
+    corpus = tmp_path / "fixtures.sql"
+    corpus.write_text("".join(data["sql"] + ";\n" for data in fixtures))
+
+    records = run_corpus("-j", 4, corpus)
+    assert len(records) == len(fixtures)
+    for record, data in zip(records, fixtures):
+        assert record["file"] == str(corpus)
+        assert record["ast"] == data["ast"], data["sql"]
+
+
+def test_statement_splitting_and_offsets(tmp_path):
+    (tmp_path / "logs" / "nested").mkdir(parents=True)
+    a = tmp_path / "logs" / "a.sql"
+    a.write_text("SELECT 1; SELECT 2;\n\n  SELECT 'x;y'\n  FROM t;\nSELECT 3\n")
+    b = tmp_path / "logs" / "nested" / "b.sql"
+    b.write_text("CREATE TABLE t(x);\nSELECT FROM WHERE;\n")
+    (tmp_path / "logs" / "ignored.txt").write_text("SELECT 4;\n")
+
+    records = run_corpus(tmp_path / "logs")
+    text = a.read_text()
+    assert [(r["file"], r["offset"]) for r in records] == [
+        (str(a), 0),
+        (str(a), text.index("SELECT 2")),
+        (str(a), text.index("SELECT 'x;y'")),
+        (str(a), text.index("SELECT 3")),
+        (str(b), 0),
+        (str(b), b.read_text().index("SELECT FROM")),
+    ]
+    assert records[2]["ast"]["columns"][0]["expr"] == {"type": "string", "value": "x;y"}
+    assert records[3]["ast"]["columns"][0]["expr"] == {"type": "integer", "value": 3}
+    assert records[4]["error"] == "No SELECT statement found in input"
+    assert records[5]["error"].startswith("Parse error:")
+
+
+def test_tokenizer_splitting(tmp_path):
+    a = tmp_path / "a.sql"
+    a.write_text(
+        "/* header; */ SELECT 1; ;\n"
+        "CREATE TRIGGER tr AFTER INSERT ON t BEGIN SELECT 1; DELETE FROM u; END;\n"
+        "SELECT 2 -- trailing; comment\n"
+    )
+    # Ends exactly on a page boundary, with no semicolon or newline
+    b = tmp_path / "b.sql"
+    b.write_text("SELECT 1;\n" * 6552 + "SELECT 123456789")
+    assert b.stat().st_size == 65536
+
+    records = run_corpus(a, b)
+    text = a.read_text()
+    assert [r["offset"] for r in records[:3]] == [
+        text.index("SELECT 1"),
+        text.index("CREATE"),
+        text.index("SELECT 2"),
+    ]
+    assert "ast" not in records[1]
+    assert records[2]["ast"]["columns"][0]["expr"] == {"type": "integer", "value": 2}
+    assert len(records) == 3 + 6553
+    assert records[-1]["offset"] == 65520
+    assert records[-1]["ast"]["columns"][0]["expr"]["value"] == 123456789
+
+
+def test_many_batches_stay_in_order(tmp_path):
+    paths = []
+    for f in range(4):
+        path = tmp_path / f"part{f}.sql"
+        path.write_text("".join(f"SELECT {f * 100000 + i};\n" for i in range(5000)))
+        paths.append(path)
+
+    records = run_corpus("-j", 8, *paths)
+    values = [r["ast"]["columns"][0]["expr"]["value"] for r in records]
+    assert values == [f * 100000 + i for f in range(4) for i in range(5000)]
+
+
+def test_subtree_counts(tmp_path):
+    sub = "SELECT id FROM users WHERE active = 1"
+    a = tmp_path / "a.sql"
+    a.write_text(f"SELECT 1;\nSELECT * FROM ({sub});\n")
+    b = tmp_path / "b.sql"
+    b.write_text(
+        "".join(f"SELECT name FROM t{i % 3} WHERE id IN ({sub});\n" for i in range(300))
+        + "SELECT FROM;\n"
+    )
+
+    records = run_corpus("-j", 4, "--subtrees", a, b)
+    counts = [r["count"] for r in records]
+    assert counts == sorted(counts, reverse=True)
+    assert all(r["count"] >= 2 and r["nodes"] >= 2 for r in records)
+
+    # The subquery, its WHERE and the outer queries over each table recur
+    top = records[0]
+    assert top["count"] == 301
+    assert top["type"] == "select"
+    assert top["first"] == {"file": str(a), "offset": a.read_text().index("SELECT *")}
+    outer = [r for r in records if r["count"] == 100]
+    assert len(outer) == 3
+    assert all(r["type"] == "select" and r["nodes"] > top["nodes"] for r in outer)
+
+    # --min-count filters, and a lone subtree is only reported at 1
+    assert run_corpus("--subtrees", "--min-count", 200, a, b) == [
+        r for r in records if r["count"] >= 200
+    ]
+    alone = run_corpus("--subtrees", "--min-count", 1, a)
+    assert {r["count"] for r in alone} == {1}
@@ -0,0 +1,205 @@
+"""
+Tests for libsqlite_ast, loaded through ctypes.
+"""
+
+import ctypes
+import json
+import threading
+from pathlib import Path
+
+LIB_PATH = Path(__file__).parent / "build" / "libsqlite_ast.so"
+AST_TESTS_DIR = Path(__file__).parent / "sqlite_ast_conformance" / "ast-tests"
+
+SQLITE_AST_OK = 0
+SQLITE_AST_ERROR = 1
+SQLITE_AST_COMPACT = 0x01
+SQLITE_AST_STATS = 0x02
+
+WRITE_FN = ctypes.CFUNCTYPE(
+    ctypes.c_int, ctypes.c_void_p, ctypes.POINTER(ctypes.c_char), ctypes.c_size_t
+)
+
+
+def load_lib():
+    lib = ctypes.CDLL(str(LIB_PATH))
+    lib.sqlite_ast_open.argtypes = [ctypes.c_int, ctypes.POINTER(ctypes.c_void_p)]
+    lib.sqlite_ast_parse.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        ctypes.c_int,
+        ctypes.POINTER(ctypes.c_char_p),
+        ctypes.POINTER(ctypes.c_size_t),
+    ]
+    lib.sqlite_ast_parse_stream.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        ctypes.c_int,
+        WRITE_FN,
+        ctypes.c_void_p,
+    ]
+    lib.sqlite_ast_errmsg.argtypes = [ctypes.c_void_p]
+    lib.sqlite_ast_errmsg.restype = ctypes.c_char_p
+    lib.sqlite_ast_close.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+def compact_json(value):
+    return json.dumps(value, separators=(",", ":"), ensure_ascii=False)
+
+
+def open_handle(lib, flags=0):
+    handle = ctypes.c_void_p()
+    assert lib.sqlite_ast_open(flags, ctypes.byref(handle)) == SQLITE_AST_OK
+    return handle
+
+
+def parse(lib, handle, sql):
+    out = ctypes.c_char_p()
+    length = ctypes.c_size_t()
+    sql = sql.encode()
+    rc = lib.sqlite_ast_parse(handle, sql, len(sql), ctypes.byref(out), ctypes.byref(length))
+    if rc != SQLITE_AST_OK:
+        return rc, lib.sqlite_ast_errmsg(handle).decode()
+    assert len(out.value) == length.value
+    return rc, out.value.decode()
+
+
+def test_one_handle_parses_every_fixture():
+    lib = load_lib()
+    handle = open_handle(lib, SQLITE_AST_COMPACT)
+    try:
+        for path in sorted(AST_TESTS_DIR.glob("*.json")):
+            data = json.loads(path.read_text())
+            rc, out = parse(lib, handle, data["sql"])
+            assert rc == SQLITE_AST_OK, f"{path.stem}: {out}"
+            assert "\n" not in out
+            assert json.loads(out) == data["ast"], path.stem
+    finally:
+        lib.sqlite_ast_close(handle)
+
+
+def test_errors_leave_the_handle_usable():
+    lib = load_lib()
+    handle = open_handle(lib)
+    try:
+        rc, msg = parse(lib, handle, "SELECT FROM WHERE")
+        assert rc == SQLITE_AST_ERROR
+        assert msg.startswith("Parse error:")
+        rc, msg = parse(lib, handle, "CREATE TABLE t(a)")
+        assert (rc, msg) == (SQLITE_AST_ERROR, "No SELECT statement found in input")
+        rc, out = parse(lib, handle, "SELECT 1")
+        assert rc == SQLITE_AST_OK
+        assert lib.sqlite_ast_errmsg(handle) == b""
+        assert out.startswith('{\n  "type": "select",')
+    finally:
+        lib.sqlite_ast_close(handle)
+
+
+def test_parse_stream_matches_parse():
+    lib = load_lib()
+    handle = open_handle(lib, SQLITE_AST_COMPACT)
+    sql = "SELECT 1 IN (" + ",".join(map(str, range(50_000))) + ")"
+    pieces = []
+
+    @WRITE_FN
+    def write(arg, data, n):
+        pieces.append(ctypes.string_at(data, n))
+        return 0
+
+    try:
+        encoded = sql.encode()
+        rc = lib.sqlite_ast_parse_stream(handle, encoded, len(encoded), write, None)
+        assert rc == SQLITE_AST_OK
+        assert len(pieces) > 1
+        assert b"".join(pieces).decode() == parse(lib, handle, sql)[1]
+    finally:
+        lib.sqlite_ast_close(handle)
+
+
+def test_handles_parse_in_parallel_threads():
+    """ctypes releases the GIL, so each thread really runs the parser."""
+    lib = load_lib()
+    cases = [json.loads(p.read_text()) for p in sorted(AST_TESTS_DIR.glob("*.json"))]
+    expected = [compact_json(case["ast"]) for case in cases]
+    failures = []
+
+    def worker():
+        handle = open_handle(lib, SQLITE_AST_COMPACT)
+        try:
+            for _ in range(20):
+                for case, want in zip(cases, expected):
+                    rc, out = parse(lib, handle, case["sql"])
+                    if rc != SQLITE_AST_OK or out != want:
+                        failures.append(case["sql"])
+        finally:
+            lib.sqlite_ast_close(handle)
+
+    threads = [threading.Thread(target=worker) for _ in range(8)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert failures == []
+
+
+def test_deep_trees_on_a_small_thread_stack():
+    """Trees as deep as SQLite accepts serialize on a thread with a small
+    stack, not just on the 8MB main thread dump_ast runs on, so a return
+    to a recursive serializer fails here rather than in an embedder."""
+    lib = load_lib()
+    n = 900
+    one = '{"type":"integer","value":1}'
+    expr = one
+    for _ in range(n - 1):
+        expr = '{"type":"binary","op":"+","left":' + expr + ',"right":' + one + "}"
+    deep = {"SELECT " + "+".join(["1"] * n): expr}
+    expr = '{"type":"name","name":"x"}'
+    for _ in range(n):
+        expr = '{"type":"isnull","operand":' + expr + "}"
+    deep["SELECT x" + " ISNULL" * n] = expr
+    results = []
+
+    def worker():
+        handle = open_handle(lib, SQLITE_AST_COMPACT)
+        try:
+            for sql in deep:
+                results.append(parse(lib, handle, sql))
+        finally:
+            lib.sqlite_ast_close(handle)
+
+    old_size = threading.stack_size(256 * 1024)
+    try:
+        thread = threading.Thread(target=worker)
+        thread.start()
+    finally:
+        threading.stack_size(old_size)
+    thread.join()
+    # Compared as text, since json.loads() would itself recurse per level
+    assert results == [
+        (
+            SQLITE_AST_OK,
+            '{"type":"select","distinct":false,"all":false,"columns":[{"expr":'
+            + expr
+            + ',"alias":null}],"from":null,"where":null,"group_by":null,'
+            '"having":null,"order_by":null,"limit":null}',
+        )
+        for expr in deep.values()
+    ]
+
+
+def test_stats_leave_memory_counters_alone():
+    """A stats handle reports its own connection's lookaside use but does
+    not switch on SQLite's process-wide memory counters."""
+    lib = load_lib()
+    lib.sqlite_ast_stats.argtypes = [ctypes.c_void_p]
+    lib.sqlite_ast_stats.restype = ctypes.c_char_p
+    handle = open_handle(lib, SQLITE_AST_COMPACT | SQLITE_AST_STATS)
+    try:
+        assert parse(lib, handle, "SELECT a FROM t")[0] == SQLITE_AST_OK
+        stats = json.loads(lib.sqlite_ast_stats(handle))
+    finally:
+        lib.sqlite_ast_close(handle)
+    assert stats["memory"] is None
+    assert set(stats["lookaside"]) == {"used_highwater", "hit", "miss_size", "miss_full"}
+    # Too late once a handle has been opened
+    assert lib.sqlite_ast_enable_memstatus() == SQLITE_AST_ERROR